@@ -3,76 +3,412 @@
 #include <linux/fs.h>
 #include <linux/miscdevice.h>
 #include <linux/platform_device.h>
+#include <linux/pm_runtime.h>
 #include <linux/of.h>
 #include <linux/hrtimer.h>
-#include <linux/kfifo.h>
 #include <linux/wait.h>
 #include <linux/uaccess.h>
 #include <linux/slab.h>
 #include <linux/poll.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/math64.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/atomic.h>
+#include <linux/rwsem.h>
+#include <linux/log2.h>
+#include <linux/idr.h>
+#include <linux/moduleparam.h>
+#include <linux/list.h>
+#include <linux/percpu.h>
+#include <linux/smp.h>
+#include <linux/cpumask.h>
+#include <linux/topology.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/anon_inodes.h>
+#include <linux/file.h>
+#include <linux/fixp-arith.h>
+#include <linux/random.h>
+#include <linux/irq_work.h>
+#if IS_REACHABLE(CONFIG_IIO_TRIGGERED_BUFFER)
+#include <linux/interrupt.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+#endif
 
 #include "nxp_simtemp.h"
 #include "nxp_simtemp_ioctl.h"
 
+#ifdef PC_BUILD
+static unsigned int instances = 1;
+module_param(instances, uint, 0444);
+MODULE_PARM_DESC(instances, "Number of simulated sensors to create (PC_BUILD only, 1..256)");
+#endif
+
+static bool shared_timer;
+module_param(shared_timer, bool, 0444);
+MODULE_PARM_DESC(shared_timer, "Default for new instances: drive them from one shared hrtimer");
+
+static bool idle_stop;
+module_param(idle_stop, bool, 0444);
+MODULE_PARM_DESC(idle_stop, "Default for new instances: stop sampling while the device is not open (runtime PM)");
+
+#if IS_REACHABLE(CONFIG_IIO_TRIGGERED_BUFFER)
+static bool iio;
+module_param(iio, bool, 0444);
+MODULE_PARM_DESC(iio, "Also register every instance as an IIO device with a triggered buffer");
+#endif
+
+/* Hands out the instance numbers used in the device node names */
+static DEFINE_IDA(simtemp_ida);
+
 #ifndef no_llseek
 #define no_llseek noop_llseek
 #endif
 
 #define DRIVER_NAME "nxp_simtemp"
-#define DEVICE_NAME "simtemp"
-
-#define FIFO_SIZE   256 // Must be a power of two for kfifo
+#define DEVICE_NAME "simtemp" /* Instances register as DEVICE_NAME "%d" */
+#define MAX_INSTANCES 256
+#define AUTOSUSPEND_DELAY_MS 2000 /* Sampling continues this long after the last close */
+
+#define FIFO_DEPTH  256 // Default history ring depth, rounded up to a power of two
+#define MIN_FIFO_DEPTH 16
+#define MAX_FIFO_DEPTH 65536
+#define RING_SLOTS  1024 // Slots in the mmap() ring, must be a power of two
+#define DEFER_SLOTS 64   // Timestamps queued for the producer thread, must be a power of two
+#define LAT_BUCKETS 64   // log2 buckets of the enqueue-to-read latency histogram
+#define EVENT_SLOTS 64   // Alert events kept for event fds, must be a power of two
 
 #define SAMPLING_MS 1000
 #define TEMP_THRESHOLD 42000
 
 /* Configuration bounds */
-#define MIN_SAMPLING_MS 10
+#define MIN_SAMPLING_MS 10 /* Legacy sampling_ms / SIMTEMP_IOC_SET_CONFIG interface */
 #define MAX_SAMPLING_MS 60000
+#define MIN_SAMPLING_US 50 /* 20 kHz */
+#define MAX_SAMPLING_US (MAX_SAMPLING_MS * USEC_PER_MSEC)
+#define MAX_AGGREGATE   1000
+#define MAX_HYSTERESIS_MC 100000
+#define WAVE_LEN 64 /* Default samples per sine/square cycle */
+#define MIN_WAVE_LEN 2
+#define MAX_WAVE_LEN 65536 /* Also the longest uploadable profile */
+#define MAX_REPLAY_LEN (1 << 20) /* 4 MiB of recorded temperatures */
+#define MAX_REPLAY_PENDING (4 * MAX_REPLAY_LEN) /* Unfinished uploads per device, in samples */
+#define WAVE_AMPLITUDE_MC 10000
+#define MAX_TIMER_SLACK_US (1000 * USEC_PER_MSEC)
+#define MIN_RAW_PERIOD_NS (MIN_SAMPLING_US * NSEC_PER_USEC) /* Floor for the internal rate when aggregating */
 
 /* Enum for simulation modes */
 enum simtemp_mode {
-	MODE_NORMAL,
-	MODE_NOISY,
-	MODE_RAMP,
+	MODE_NORMAL = SIMTEMP_MODE_NORMAL,
+	MODE_NOISY = SIMTEMP_MODE_NOISY,
+	MODE_RAMP = SIMTEMP_MODE_RAMP,
+	MODE_SINE = SIMTEMP_MODE_SINE,       /* Table-driven modes from here on, see struct simtemp_wave */
+	MODE_SQUARE = SIMTEMP_MODE_SQUARE,
+	MODE_PROFILE = SIMTEMP_MODE_PROFILE, /* Replays a table uploaded with SIMTEMP_IOC_SET_PROFILE */
+	MODE_REPLAY = SIMTEMP_MODE_REPLAY,   /* Plays back a trace uploaded with write(), see SIMTEMP_IOC_REPLAY_BEGIN */
 	MODE_MAX,
 };
 
+/* Where sample generation runs */
+enum simtemp_producer {
+	PRODUCER_HARDIRQ, /* Everything in the hrtimer callback (default) */
+	PRODUCER_SOFTIRQ, /* hrtimer callback runs from softirq (HRTIMER_MODE_SOFT) */
+	PRODUCER_THREAD,  /* hardirq only timestamps, a kthread does the rest */
+	PRODUCER_MAX,
+};
+
+/* Clock of simtemp_sample.timestamp_ns, named as in IIO's current_timestamp_clock */
+enum simtemp_ts_clock {
+	TS_CLOCK_REALTIME, /* Default, steps with settimeofday() and NTP */
+	TS_CLOCK_MONOTONIC,
+	TS_CLOCK_MONOTONIC_RAW,
+	TS_CLOCK_BOOTTIME,
+	TS_CLOCK_MAX,
+};
+
+/* What bumps alert_count and so raises EPOLLPRI */
+enum simtemp_alert_mode {
+	ALERT_LEVEL = SIMTEMP_ALERT_LEVEL, /* Every sample in the alarm state (default) */
+	ALERT_EDGE = SIMTEMP_ALERT_EDGE,   /* Only entering or leaving the alarm state */
+	ALERT_MODE_MAX,
+};
+
+/*
+ * Lookup table for the table-driven modes, replayed one entry per raw sample.
+ * Only swapped while the producer is paused, see simtemp_wave_install().
+ */
+struct simtemp_wave {
+	enum simtemp_mode mode; /* Mode the table was built or uploaded for */
+	bool loop; /* Wrap around at the end; otherwise stop producing samples */
+	u32 len;
+	s32 temp_mC[];
+};
+
+/* Running window of raw samples folded into one summary record */
+struct simtemp_agg {
+	s64 sum_mC;
+	s32 min_mC;
+	s32 max_mC;
+	u32 count;
+	u32 factor; /* sdev->aggregate when the window was opened */
+	u32 flags;
+	u64 first_ns;
+};
+
+/* Enqueue-to-read latency, bucket n counts deltas in [2^(n-1), 2^n) ns */
+struct simtemp_lat_hist {
+	u64 bucket[LAT_BUCKETS];
+};
+
 struct simtemp_device {
 
    	struct platform_device *pdev;
+	int id; /* Instance number, /dev/simtemp<id> */
     struct miscdevice miscdev;
     struct hrtimer timer;
 
-	spinlock_t lock; /* Protects kfifo and event_flags */
-    wait_queue_head_t wq;
-
-
-   	/* Configuration */
-	u32 sampling_ms;
+	/*
+	 * Serializes configuration writers. The data path (producer, read, poll)
+	 * never takes it: config is read with READ_ONCE(), counters are atomics
+	 * and the history/mmap rings are single-producer with release/acquire
+	 * publication.
+	 */
+	spinlock_t lock;
+	struct mutex cfg_lock; /* Serializes timer (re)configuration from process context */
+
+   	/* Configuration: written rarely, read by the producer on every tick */
+	u32 sampling_us;
 	s32 threshold_mC;
+	s32 hysteresis_mC; /* The alarm clears below threshold_mC - hysteresis_mC */
+	enum simtemp_alert_mode alert_mode;
+	u32 wake_watermark; /* Records queued before readers are woken, see simtemp_wake_due() */
+	u32 wake_timeout_us; /* Or how long the oldest of them may wait, 0 = no limit */
 	enum simtemp_mode mode;
-
-	/* State & Stats */
-	s32 ramp_temp;
-	u32 event_flags;
-	u64 update_count;
-	u64 alert_count;
+	enum simtemp_ts_clock ts_clock;
+	u64 seed; /* Seed of the jitter PRNG, written back to rng_state on reset */
+	u32 wave_len; /* Samples per MODE_SINE/MODE_SQUARE cycle */
+	s32 wave_amplitude_mC;
+	struct simtemp_wave *wave; /* Table of the table-driven modes, NULL until first used */
+	atomic_t replay_pending; /* Samples allocated by unfinished uploads on all files */
+	u32 aggregate; /* Raw samples per record, 1 = no aggregation */
+	u64 period_ns; /* Timer period derived from the above, read locklessly by the producer */
+	enum simtemp_producer producer;
+	bool shared_timer; /* Driven by a shared simtemp_wheel instead of its own timer */
+	bool phase_continuous; /* Timer restarts keep the tick grid, see simtemp_timer_next() */
+	u32 timer_slack_us; /* How late a tick may fire, so it can be batched with other timers */
+	bool idle; /* Runtime suspended: the timer stays stopped, see simtemp_runtime_suspend() */
+	int cpu; /* CPU the timer and producer thread run on, -1 for any */
 	int last_error;
+	struct task_struct *producer_task; /* PRODUCER_THREAD only */
+
+	/* IIO front-end, NULL unless registered, see simtemp_iio_init() */
+	struct iio_dev *indio_dev;
+	struct iio_trigger *iio_trig;
+	struct irq_work iio_work; /* Fires iio_trig from hardirq context */
+
+	/*
+	 * History ring shared by every reader. The producer writes each sample
+	 * once and publishes it by advancing hist_head; readers keep their own
+	 * cursor in struct simtemp_file and detect overruns from the distance.
+	 */
+	struct simtemp_sample *hist;
+	struct simtemp_summary *hist_sum; /* Same slots, for SIMTEMP_RECORD_SUMMARY readers */
+	u64 *hist_enq_ns; /* CLOCK_MONOTONIC time each slot was published, for the latency histogram */
+	u32 fifo_depth; /* Slots in hist/hist_sum, a power of two */
+
+	/* Shared mmap() ring: header page followed by the sample slots */
+	struct simtemp_ring_header *ring_hdr;
+	struct simtemp_sample *ring_data;
+	size_t ring_bytes;
+	atomic_t ring_maps; /* Live VMAs; the ring is only filled while mapped */
+
+	/*
+	 * Producer-written state. It starts on its own cache line so that the
+	 * stores done on every tick do not invalidate the read-mostly fields
+	 * above, nor the wait queue and locks consumers take below.
+	 */
+	u64 hist_head ____cacheline_aligned_in_smp; /* Sequence number of the next sample to be written */
+	u64 ring_head; /* Kernel copy of the producer index, never read back from user space */
+	struct simtemp_agg agg;
+	s32 ramp_temp;
+	u64 rng_state; /* xorshift64 state, never zero */
+	u32 wave_pos; /* Next entry of sdev->wave */
+	bool wave_done; /* A non-looping table reached its end */
+	atomic64_t update_count;
+	atomic64_t alert_count;
+	bool alert_active; /* In the alarm state, see simtemp_alert_update() */
+	u64 defer_drops; /* Ticks lost because the producer thread fell behind */
+	u64 timer_ticks;
+	u64 timer_overruns; /* Expiries skipped because the callback ran too late */
+	u64 late_sum_ns; /* Callback start relative to the scheduled expiry */
+	u64 late_max_ns;
+	u64 last_expiry_ns; /* CLOCK_MONOTONIC deadline of the last tick, the phase a restart continues */
+	u64 reconfig_missed; /* Ticks skipped by phase-continuous restarts, written under cfg_lock */
+	u64 produce_ns; /* Time spent in simtemp_produce(), for producer CPU usage */
+	u64 last_wake_ns; /* CLOCK_MONOTONIC time of the last reader wakeup */
+	u64 wake_seq; /* hist_head at the last reader wakeup */
+	s32 last_temp_mC; /* Newest record, for in_temp_raw */
+	s32 iio_temp_mC; /* Record handed to the IIO trigger, stable while iio_work is busy */
+	s64 iio_timestamp;
+
+	/* PRODUCER_THREAD: timestamps handed from the hrtimer to the kthread */
+	unsigned int defer_head; /* Written by the hrtimer callback */
+	u64 defer_ts[DEFER_SLOTS];
+
+	/* Alert events, a small history of their own read through event fds */
+	u64 event_head; /* Sequence number of the next event to be written */
+	struct simtemp_event events[EVENT_SLOTS];
+
+	/* Shared timer membership, see simtemp_wheel_callback() */
+	struct simtemp_wheel *wheel;
+	struct list_head wheel_node;
+	u64 wheel_next; /* CLOCK_MONOTONIC deadline of the next tick */
+	bool wheel_wake;
+
+	/* Consumer side: taken by readers and poll(), and the producer thread's cursor */
+    wait_queue_head_t wq ____cacheline_aligned_in_smp;
+	wait_queue_head_t event_wq; /* Only woken for alert events */
+	struct rw_semaphore hist_rwsem; /* Readers hold it shared while copying; resize takes it exclusive */
+	unsigned int defer_tail; /* Written by the producer thread */
+	u64 __percpu *dropped; /* Samples lost by readers (history overruns) or the mmap ring */
+	atomic64_t fifo_hwm; /* Largest backlog a reader found in the history */
+	atomic64_t wake_lat_sum_ns; /* Producer wakeup until a blocked read() returns */
+	atomic64_t wake_lat_max_ns;
+	atomic64_t wake_lat_count;
+	struct simtemp_lat_hist __percpu *lat_hist;
+
+	struct dentry *debugfs;
+};
+
+/* After struct simtemp_device: simtemp_config_changed copies from it */
+#define CREATE_TRACE_POINTS
+#include "nxp_simtemp_trace.h"
+
+/* Per-open state */
+struct simtemp_file {
+	struct simtemp_device *sdev;
+	struct mutex read_lock; /* Serializes readers sharing this file */
+	u64 cursor;     /* Sequence number of the next sample to return */
+	u64 overruns;   /* Samples overwritten before this reader got to them */
+	u64 alert_seen; /* sdev->alert_count at the last read, for EPOLLPRI */
+	u32 format;     /* SIMTEMP_RECORD_* returned by read() */
+	struct mutex upload_lock; /* Serializes writers of @replay */
+	struct simtemp_wave *replay; /* Trace being uploaded with write(), NULL if none */
+	size_t replay_off; /* Bytes of @replay written so far */
+	atomic_t ring_maps; /* Live VMAs of this file; while any, poll() reports ring occupancy */
+};
 
-	/* The kfifo to buffer samples */
-    DECLARE_KFIFO(sample_fifo, struct simtemp_sample, FIFO_SIZE);
+/* Per event fd state, see SIMTEMP_IOC_GET_EVENT_FD */
+struct simtemp_event_file {
+	struct simtemp_device *sdev;
+	struct file *parent; /* The /dev/simtemp<N> file, pinned while the event fd is open */
+	struct mutex read_lock;
+	u64 cursor; /* Sequence number of the next event to return */
 };
 
 /* --- Temperature Simulation --- */
 
+#define BASE_TEMP_MC 42000 /* 42.000 °C */
+
+/*
+ * xorshift64 (Marsaglia): a few shifts per sample and, unlike
+ * get_random_u32(), repeatable from the seed attribute.
+ */
+static u32 simtemp_rand(struct simtemp_device *sdev)
+{
+	u64 x = sdev->rng_state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	sdev->rng_state = x;
+	return x >> 32;
+}
+
+/* 0 picks a random seed */
+static void simtemp_rng_seed(struct simtemp_device *sdev, u64 seed)
+{
+	while (!seed){
+		seed = get_random_u64();
+	}
+	WRITE_ONCE(sdev->seed, seed);
+	sdev->rng_state = seed;
+}
+
+static bool simtemp_mode_is_table(enum simtemp_mode mode)
+{
+	return mode >= MODE_SINE;
+}
+
+static struct simtemp_wave *simtemp_wave_alloc(enum simtemp_mode mode, u32 len, bool loop)
+{
+	struct simtemp_wave *wave;
+
+	wave = kvmalloc(struct_size(wave, temp_mC, len), GFP_KERNEL);
+	if (!wave){
+		return NULL;
+	}
+	wave->mode = mode;
+	wave->loop = loop;
+	wave->len = len;
+	return wave;
+}
+
+/* One cycle of a sine or square wave around BASE_TEMP_MC */
+static struct simtemp_wave *simtemp_wave_build(enum simtemp_mode mode, u32 len, s32 amplitude_mC)
+{
+	struct simtemp_wave *wave;
+	u32 i;
+
+	wave = simtemp_wave_alloc(mode, len, true);
+	if (!wave){
+		return NULL;
+	}
+	for (i = 0; i < len; i++) {
+		if (mode == MODE_SINE){
+			wave->temp_mC[i] = BASE_TEMP_MC + (s32)(((s64)amplitude_mC * fixp_sin32_rad(i, len)) >> 31);
+		} else {
+			wave->temp_mC[i] = BASE_TEMP_MC + (i < len / 2 ? amplitude_mC : -amplitude_mC);
+		}
+	}
+	return wave;
+}
+
+/* Table-driven modes: the per-sample cost is one load and an index increment */
+static s32 simtemp_wave_next(struct simtemp_device *sdev)
+{
+	const struct simtemp_wave *wave = sdev->wave;
+	s32 temp = wave->temp_mC[sdev->wave_pos];
+
+	if (++sdev->wave_pos == wave->len) {
+		sdev->wave_pos = 0;
+		if (!wave->loop){
+			sdev->wave_done = true;
+		}
+	}
+	return temp;
+}
+
 static s32 generate_temp(struct simtemp_device *sdev)
 {
-	s32 base_temp = 42000; /* 42.000 °C */
+	s32 base_temp = BASE_TEMP_MC;
 	s32 temp;
-	s32 jitter = (get_random_u32() % 2000) - 1000; /* +/- 1.0 °C */
+	s32 jitter;
+	enum simtemp_mode mode = READ_ONCE(sdev->mode);
 
-	switch (sdev->mode) {
+	if (simtemp_mode_is_table(mode)){
+		return simtemp_wave_next(sdev);
+	}
+
+	jitter = (simtemp_rand(sdev) % 2000) - 1000; /* +/- 1.0 °C */
+	switch (mode) {
 		case MODE_NOISY:
 			jitter *= 5; /* More noise */
 			/* fallthrough */
@@ -94,243 +430,2729 @@ static s32 generate_temp(struct simtemp_device *sdev)
 	return temp;
 }
 
-static enum hrtimer_restart simtemp_timer_callback(struct hrtimer *timer)
+/* --- mmap() Ring --- */
+
+static int simtemp_ring_alloc(struct simtemp_device *sdev)
 {
-    unsigned long flags;
+	struct simtemp_ring_header *hdr;
 
-    struct simtemp_device *sdev = container_of(timer, struct simtemp_device, timer);
-    struct simtemp_sample sample;
+	sdev->ring_bytes = PAGE_SIZE + PAGE_ALIGN(RING_SLOTS * sizeof(struct simtemp_sample));
+	hdr = vmalloc_user(sdev->ring_bytes);
+	if (!hdr){
+		return -ENOMEM;
+	}
 
-	sample.timestamp_ns = ktime_get_real_ns();
-	sample.temp_mC = generate_temp(sdev);
-	sample.flags = SIMTEMP_FLAG_NEW_SAMPLE;
+	hdr->version = SIMTEMP_RING_VERSION;
+	hdr->nr_slots = RING_SLOTS;
+	hdr->slot_size = sizeof(struct simtemp_sample);
+	hdr->data_offset = PAGE_SIZE;
 
-	spin_lock_irqsave(&sdev->lock, flags);
+	sdev->ring_hdr = hdr;
+	sdev->ring_data = (void *)hdr + PAGE_SIZE;
+	sdev->ring_head = 0;
+	atomic_set(&sdev->ring_maps, 0);
+
+	return 0;
+}
+
+/* Number of unconsumed slots; the tail comes from user space so it is not trusted */
+static u64 simtemp_ring_count(struct simtemp_device *sdev)
+{
+	u64 used = sdev->ring_head - smp_load_acquire(&sdev->ring_hdr->tail);
+
+	return min_t(u64, used, RING_SLOTS);
+}
+
+/* Called from the producer only */
+static void simtemp_ring_push(struct simtemp_device *sdev, const struct simtemp_sample *sample)
+{
+	struct simtemp_ring_header *hdr = sdev->ring_hdr;
+	u64 head = sdev->ring_head;
 
-	sdev->update_count++;
-	if (sample.temp_mC >= sdev->threshold_mC) {
-		sample.flags |= SIMTEMP_FLAG_THRESHOLD_CROSSED;
-		sdev->event_flags |= SIMTEMP_FLAG_THRESHOLD_CROSSED;
-		sdev->alert_count++;
+	if (!atomic_read(&sdev->ring_maps)){
+		return;
 	}
 
-    pr_debug("nxp_simtemp - timestamp: %llu, temp: %i, flags: %i\n", sample.timestamp_ns, sample.temp_mC, sample.flags);
+	if (head - smp_load_acquire(&hdr->tail) >= RING_SLOTS) {
+		hdr->dropped++;
+		this_cpu_inc(*sdev->dropped);
+		trace_simtemp_sample_dropped(sdev->id, SIMTEMP_DROP_RING, 1);
+		return;
+	}
 
-    kfifo_put(&sdev->sample_fifo, sample);
+	sdev->ring_data[head & (RING_SLOTS - 1)] = *sample;
+	sdev->ring_head = head + 1;
+	/* Publish the slot before the new head becomes visible to the consumer */
+	smp_store_release(&hdr->head, sdev->ring_head);
+}
 
-    /* Reschedule the timer */
-	hrtimer_forward_now(timer, ms_to_ktime(sdev->sampling_ms));
+static void simtemp_vm_open(struct vm_area_struct *vma)
+{
+	struct simtemp_file *sfile = vma->vm_private_data;
+	struct simtemp_device *sdev = sfile->sdev;
+
+	atomic_inc(&sfile->ring_maps);
+	if (atomic_inc_return(&sdev->ring_maps) == 1) {
+		/*
+		 * First mapping: start from an empty ring rather than stale data.
+		 * If the producer pushes concurrently the tail lands at most one
+		 * slot behind the head, and that slot is already published.
+		 */
+		WRITE_ONCE(sdev->ring_hdr->tail, READ_ONCE(sdev->ring_head));
+	}
+}
 
-	spin_unlock_irqrestore(&sdev->lock, flags);
+static void simtemp_vm_close(struct vm_area_struct *vma)
+{
+	struct simtemp_file *sfile = vma->vm_private_data;
+
+	atomic_dec(&sfile->sdev->ring_maps);
+	atomic_dec(&sfile->ring_maps);
+}
+
+static const struct vm_operations_struct simtemp_vm_ops = {
+	.open = simtemp_vm_open,
+	.close = simtemp_vm_close,
+};
+
+/* --- History Ring --- */
+
+/* The history is placed on the memory node of the CPU the instance runs on */
+static int simtemp_hist_alloc(struct simtemp_device *sdev, u32 depth, struct simtemp_sample **hist,
+			      struct simtemp_summary **hist_sum, u64 **enq_ns)
+{
+	int node = sdev->cpu >= 0 ? cpu_to_node(sdev->cpu) : NUMA_NO_NODE;
+
+	*hist = kvzalloc_node(array_size(depth, sizeof(**hist)), GFP_KERNEL, node);
+	*hist_sum = kvzalloc_node(array_size(depth, sizeof(**hist_sum)), GFP_KERNEL, node);
+	*enq_ns = kvzalloc_node(array_size(depth, sizeof(**enq_ns)), GFP_KERNEL, node);
+	if (!*hist || !*hist_sum || !*enq_ns) {
+		kvfree(*hist);
+		kvfree(*hist_sum);
+		kvfree(*enq_ns);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static void simtemp_hist_free(struct simtemp_device *sdev)
+{
+	kvfree(sdev->hist);
+	kvfree(sdev->hist_sum);
+	kvfree(sdev->hist_enq_ns);
+}
+
+/* Like kfifo_alloc(), depths are rounded up to a power of two */
+static int simtemp_fifo_depth_check(u32 *depth)
+{
+	if (*depth < MIN_FIFO_DEPTH || *depth > MAX_FIFO_DEPTH){
+		return -EINVAL;
+	}
+	*depth = roundup_pow_of_two(*depth);
+	return 0;
+}
+
+/* Called from the producer only */
+static void simtemp_hist_push(struct simtemp_device *sdev, const struct simtemp_summary *rec)
+{
+	u64 head = sdev->hist_head;
+	size_t idx = head & (sdev->fifo_depth - 1);
+
+	/*
+	 * Order the previous head update before overwriting the oldest slot, so
+	 * a reader that still sees the old head knows only slot 'head' may be
+	 * in flux (see simtemp_hist_valid()).
+	 */
+	smp_wmb();
+	sdev->hist[idx] = rec->sample;
+	sdev->hist_sum[idx] = *rec;
+	sdev->hist_enq_ns[idx] = ktime_get_ns();
+	smp_store_release(&sdev->hist_head, head + 1);
+	trace_simtemp_sample_enqueued(sdev->id, head, rec->sample.timestamp_ns,
+				      rec->sample.temp_mC, rec->sample.flags);
+}
+
+/*
+ * A sequence number is intact while it is newer than head - fifo_depth: the
+ * slot of head - fifo_depth itself may be mid-overwrite by the producer.
+ */
+static bool simtemp_hist_valid(struct simtemp_device *sdev, u64 head, u64 seq)
+{
+	return head - seq < sdev->fifo_depth;
+}
+
+static bool simtemp_hist_pending(struct simtemp_device *sdev, struct simtemp_file *sfile)
+{
+	return smp_load_acquire(&sdev->hist_head) != sfile->cursor;
+}
+
+static size_t simtemp_record_size(struct simtemp_file *sfile)
+{
+	return sfile->format == SIMTEMP_RECORD_SUMMARY ? sizeof(struct simtemp_summary) : sizeof(struct simtemp_sample);
+}
+
+/* Copies @n records starting at @seq, splitting the copy where the ring wraps */
+static int simtemp_hist_copy(struct simtemp_device *sdev, struct simtemp_file *sfile,
+			     char __user *user_buf, u64 seq, size_t n)
+{
+	const char *base = sfile->format == SIMTEMP_RECORD_SUMMARY ? (const char *)sdev->hist_sum : (const char *)sdev->hist;
+	size_t rec_size = simtemp_record_size(sfile);
+	size_t idx = seq & (sdev->fifo_depth - 1);
+	size_t first = min_t(size_t, n, sdev->fifo_depth - idx);
+
+	if (copy_to_user(user_buf, base + idx * rec_size, first * rec_size)){
+		return -EFAULT;
+	}
+	if (n > first && copy_to_user(user_buf + first * rec_size, base, (n - first) * rec_size)){
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/* --- Aggregation --- */
+
+/* Timer period: the sampling period is split evenly across the aggregation window */
+static ktime_t simtemp_period(struct simtemp_device *sdev)
+{
+	return ns_to_ktime(READ_ONCE(sdev->period_ns));
+}
+
+/* Called with sdev->lock held whenever sampling_us or aggregate change */
+static void simtemp_update_period(struct simtemp_device *sdev)
+{
+	WRITE_ONCE(sdev->period_ns, div_u64((u64)sdev->sampling_us * NSEC_PER_USEC, sdev->aggregate));
+}
+
+static u64 simtemp_slack_ns(struct simtemp_device *sdev)
+{
+	return (u64)READ_ONCE(sdev->timer_slack_us) * NSEC_PER_USEC;
+}
+
+static bool simtemp_period_valid(u32 sampling_us, u32 aggregate)
+{
+	return div_u64((u64)sampling_us * NSEC_PER_USEC, aggregate) >= MIN_RAW_PERIOD_NS;
+}
+
+/*
+ * Folds a raw sample into the current window. Returns true once the window
+ * holds sdev->aggregate samples and @rec has been filled in.
+ */
+static bool simtemp_agg_add(struct simtemp_device *sdev, const struct simtemp_sample *sample,
+			    struct simtemp_summary *rec)
+{
+	struct simtemp_agg *agg = &sdev->agg;
+	u32 factor = READ_ONCE(sdev->aggregate);
+
+	/* A new factor restarts the window rather than mixing sizes */
+	if (!agg->count || agg->factor != factor) {
+		agg->count = 0;
+		agg->factor = factor;
+		agg->sum_mC = 0;
+		agg->flags = 0;
+		agg->min_mC = sample->temp_mC;
+		agg->max_mC = sample->temp_mC;
+		agg->first_ns = sample->timestamp_ns;
+	}
+	agg->sum_mC += sample->temp_mC;
+	agg->min_mC = min(agg->min_mC, sample->temp_mC);
+	agg->max_mC = max(agg->max_mC, sample->temp_mC);
+	agg->flags |= sample->flags;
+	agg->count++;
+
+	if (agg->count < agg->factor){
+		return false;
+	}
+
+	rec->sample.timestamp_ns = sample->timestamp_ns;
+	rec->sample.temp_mC = div_s64(agg->sum_mC, agg->count);
+	rec->sample.flags = agg->flags;
+	if (agg->count > 1){
+		rec->sample.flags |= SIMTEMP_FLAG_SUMMARY;
+	}
+	rec->first_timestamp_ns = agg->first_ns;
+	rec->min_mC = agg->min_mC;
+	rec->max_mC = agg->max_mC;
+	rec->count = agg->count;
+	rec->version = SIMTEMP_SUMMARY_VERSION;
+
+	agg->count = 0;
+	return true;
+}
+
+static enum hrtimer_mode simtemp_hrtimer_mode(struct simtemp_device *sdev)
+{
+	switch (sdev->producer) {
+	case PRODUCER_SOFTIRQ:
+		return HRTIMER_MODE_ABS_SOFT;
+	case PRODUCER_THREAD:
+		return HRTIMER_MODE_ABS_HARD;
+	default:
+		return HRTIMER_MODE_ABS;
+	}
+}
+
+/* --- Metrics --- */
+
+/*
+ * Adds the enqueue-to-read latency of the @n records from @seq that were just
+ * copied out. Called with hist_rwsem held; if the producer laps the reader
+ * meanwhile, the overwritten slots are skipped rather than miscounted.
+ */
+static void simtemp_lat_account(struct simtemp_device *sdev, u64 seq, size_t n)
+{
+	struct simtemp_lat_hist *lh;
+	u64 now = ktime_get_ns();
+	u64 enq, head;
+	size_t i;
+
+	lh = get_cpu_ptr(sdev->lat_hist);
+	for (i = 0; i < n; i++) {
+		enq = READ_ONCE(sdev->hist_enq_ns[(seq + i) & (sdev->fifo_depth - 1)]);
+		smp_rmb();
+		head = READ_ONCE(sdev->hist_head);
+		if (!simtemp_hist_valid(sdev, head, seq + i)){
+			continue;
+		}
+		lh->bucket[min_t(unsigned int, fls64(now - enq), LAT_BUCKETS - 1)]++;
+	}
+	put_cpu_ptr(sdev->lat_hist);
+}
+
+/* Lock-free maximum for metrics updated by several readers */
+static void simtemp_stat_max(atomic64_t *v, s64 val)
+{
+	s64 old = atomic64_read(v);
+
+	while (val > old && !atomic64_try_cmpxchg(v, &old, val))
+		;
+}
+
+/* Records how late a tick started; @missed expiries were skipped entirely */
+static void simtemp_account_tick(struct simtemp_device *sdev, u64 late_ns, u64 missed)
+{
+	/* Only the instance's timer callback writes these, one tick at a time */
+	WRITE_ONCE(sdev->timer_ticks, sdev->timer_ticks + 1);
+	WRITE_ONCE(sdev->timer_overruns, sdev->timer_overruns + missed);
+	WRITE_ONCE(sdev->late_sum_ns, sdev->late_sum_ns + late_ns);
+	if (late_ns > sdev->late_max_ns){
+		WRITE_ONCE(sdev->late_max_ns, late_ns);
+	}
+}
 
-	/* Wake up any processes waiting for data or events */
+/* Wake up any processes waiting for data or events */
+static void simtemp_wake_readers(struct simtemp_device *sdev)
+{
+	sdev->wake_seq = sdev->hist_head;
+	WRITE_ONCE(sdev->last_wake_ns, ktime_get_ns());
 	wake_up_interruptible(&sdev->wq);
+}
+
+/*
+ * hrtimer_forward_now() that also accounts lateness and overruns. The forward
+ * keeps the slack range the timer was armed with.
+ */
+static void simtemp_timer_forward(struct simtemp_device *sdev, struct hrtimer *timer)
+{
+	ktime_t now = hrtimer_cb_get_time(timer);
+	ktime_t expires = hrtimer_get_softexpires(timer);
+	u64 late = ktime_to_ns(ktime_sub(now, expires));
+	u64 expiries;
+
+	WRITE_ONCE(sdev->last_expiry_ns, ktime_to_ns(expires));
+	expiries = hrtimer_forward(timer, now, simtemp_period(sdev));
+	simtemp_account_tick(sdev, late, expiries ? expiries - 1 : 0);
+}
+
+/* --- Shared Timer --- */
+
+struct simtemp_timer_arm {
+	struct hrtimer *timer;
+	ktime_t expires;
+	u64 slack_ns;
+	enum hrtimer_mode mode;
+};
+
+static void simtemp_hrtimer_start_local(void *data)
+{
+	struct simtemp_timer_arm *arm = data;
+
+	hrtimer_start_range_ns(arm->timer, arm->expires, arm->slack_ns, arm->mode | HRTIMER_MODE_PINNED);
+}
+
+/*
+ * hrtimer_start_range_ns() pinned to @cpu, so the callback and the state it
+ * writes stay on that CPU. Falls back to an unpinned start if @cpu is
+ * negative or offline.
+ */
+static void simtemp_hrtimer_start_on(struct hrtimer *timer, ktime_t expires, u64 slack_ns,
+				     enum hrtimer_mode mode, int cpu)
+{
+	struct simtemp_timer_arm arm = { .timer = timer, .expires = expires, .slack_ns = slack_ns, .mode = mode };
+
+	if (cpu < 0 || smp_call_function_single(cpu, simtemp_hrtimer_start_local, &arm, 1)){
+		hrtimer_start_range_ns(timer, expires, slack_ns, mode);
+	}
+}
+
+/*
+ * Instances with shared_timer set are not driven by their own hrtimer but by
+ * one timer per producer context (and per CPU for pinned instances).
+ * Deadlines sit on a grid of the period, so instances running at the same
+ * rate fall due on the same tick and are all serviced by a single interrupt,
+ * followed by one pass of wakeups.
+ */
+struct simtemp_wheel {
+	struct hrtimer timer;
+	enum hrtimer_mode mode;
+	int cpu; /* -1 for the unpinned wheels */
+	struct list_head members; /* Only changed while the timer is cancelled */
+};
+
+/* [0] hardirq and thread producers, [1] softirq */
+static struct simtemp_wheel simtemp_wheels[2];
+struct simtemp_cpu_wheels {
+	struct simtemp_wheel wheel[2];
+};
+static DEFINE_PER_CPU(struct simtemp_cpu_wheels, simtemp_cpu_wheels);
+static DEFINE_MUTEX(simtemp_wheel_lock); /* Serializes joins and leaves */
+static bool simtemp_wheels_ready;
+
+static bool simtemp_tick(struct simtemp_device *sdev, u64 timestamp_ns);
+
+/*
+ * Sample timestamp, read once at the top of the timer callback. The
+ * monotonic clocks use the NMI-safe fast accessors, which skip the seqcount
+ * retry loop of ktime_get_*().
+ */
+static u64 simtemp_clock_read(enum simtemp_ts_clock clock)
+{
+	switch (clock) {
+	case TS_CLOCK_MONOTONIC:
+		return ktime_get_mono_fast_ns();
+	case TS_CLOCK_MONOTONIC_RAW:
+		return ktime_get_raw_fast_ns();
+	case TS_CLOCK_BOOTTIME:
+		return ktime_get_boot_fast_ns();
+	default:
+		return ktime_get_real_ns();
+	}
+}
+
+/* First deadline after @now on the grid of @period */
+static u64 simtemp_wheel_align(u64 now, u64 period)
+{
+	return (div64_u64(now, period) + 1) * period;
+}
+
+static enum hrtimer_restart simtemp_wheel_callback(struct hrtimer *timer)
+{
+	struct simtemp_wheel *wheel = container_of(timer, struct simtemp_wheel, timer);
+	struct simtemp_device *sdev;
+	u64 now = ktime_to_ns(hrtimer_cb_get_time(timer));
+	u64 ts[TS_CLOCK_MAX] = { 0 }; /* Every instance due on this tick is sampled at once */
+	u64 next = U64_MAX, hard = U64_MAX;
+	u64 period, late, missed;
+	enum simtemp_ts_clock clock;
+
+	/* Generate every due sample first... */
+	list_for_each_entry(sdev, &wheel->members, wheel_node) {
+		if (sdev->wheel_next <= now) {
+			period = READ_ONCE(sdev->period_ns);
+			clock = READ_ONCE(sdev->ts_clock);
+			if (!ts[clock]){
+				ts[clock] = simtemp_clock_read(clock);
+			}
+			sdev->wheel_wake = simtemp_tick(sdev, ts[clock]);
+			late = now - sdev->wheel_next;
+			WRITE_ONCE(sdev->last_expiry_ns, sdev->wheel_next);
+			missed = 0;
+			sdev->wheel_next += period;
+			if (sdev->wheel_next <= now){
+				/* Overrun: skip the missed ticks like hrtimer_forward() */
+				missed = div64_u64(now - sdev->wheel_next, period) + 1;
+				sdev->wheel_next = simtemp_wheel_align(now, period);
+			}
+			simtemp_account_tick(sdev, late, missed);
+		}
+		next = min(next, sdev->wheel_next);
+		hard = min(hard, sdev->wheel_next + simtemp_slack_ns(sdev));
+	}
 
+	/* ...then wake the readers in one batch */
+	list_for_each_entry(sdev, &wheel->members, wheel_node) {
+		if (sdev->wheel_wake) {
+			sdev->wheel_wake = false;
+			simtemp_wake_readers(sdev);
+		}
+	}
 
+	if (next == U64_MAX){
+		return HRTIMER_NORESTART;
+	}
+	/* Fires no later than the tightest member allows */
+	hrtimer_set_expires_range_ns(timer, ns_to_ktime(next), hard - next);
 
 	return HRTIMER_RESTART;
 }
 
-/* --- Sysfs Attributes --- */
+/* Called with simtemp_wheel_lock held and the wheel timer cancelled */
+static void simtemp_wheel_arm(struct simtemp_wheel *wheel)
+{
+	struct simtemp_device *sdev;
+	u64 next = U64_MAX, hard = U64_MAX;
 
-/* sampling_ms (RW) */
-static ssize_t sampling_ms_show(struct device *dev, struct device_attribute *attr, char *buf)
+	list_for_each_entry(sdev, &wheel->members, wheel_node){
+		next = min(next, sdev->wheel_next);
+		hard = min(hard, sdev->wheel_next + simtemp_slack_ns(sdev));
+	}
+	if (next != U64_MAX){
+		simtemp_hrtimer_start_on(&wheel->timer, ns_to_ktime(next), hard - next, wheel->mode, wheel->cpu);
+	}
+}
+
+static void simtemp_wheel_init(struct simtemp_wheel *wheel, int idx, int cpu)
 {
-	struct simtemp_device *sdev = dev_get_drvdata(dev);
-	return sysfs_emit(buf, "%u\n", sdev->sampling_ms);
+	wheel->mode = idx ? HRTIMER_MODE_ABS_SOFT : HRTIMER_MODE_ABS;
+	wheel->cpu = cpu;
+	hrtimer_init(&wheel->timer, CLOCK_MONOTONIC, wheel->mode);
+	wheel->timer.function = &simtemp_wheel_callback;
+	INIT_LIST_HEAD(&wheel->members);
 }
-static ssize_t sampling_ms_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+
+static void simtemp_wheel_join(struct simtemp_device *sdev, u64 next)
 {
-	struct simtemp_device *sdev = dev_get_drvdata(dev);
-	u32 new_period;
-	int ret = kstrtou32(buf, 10, &new_period);
-	unsigned long flags;
+	int idx = sdev->producer == PRODUCER_SOFTIRQ;
+	struct simtemp_wheel *wheel;
+	int i, cpu;
+
+	mutex_lock(&simtemp_wheel_lock);
+	if (!simtemp_wheels_ready) {
+		for (i = 0; i < ARRAY_SIZE(simtemp_wheels); i++) {
+			simtemp_wheel_init(&simtemp_wheels[i], i, -1);
+			for_each_possible_cpu(cpu){
+				simtemp_wheel_init(&per_cpu(simtemp_cpu_wheels, cpu).wheel[i], i, cpu);
+			}
+		}
+		simtemp_wheels_ready = true;
+	}
+	wheel = sdev->cpu >= 0 ? &per_cpu(simtemp_cpu_wheels, sdev->cpu).wheel[idx] : &simtemp_wheels[idx];
+
+	/* Waits for a running callback, so the member list is ours until re-armed */
+	hrtimer_cancel(&wheel->timer);
+	sdev->wheel_next = next;
+	sdev->wheel_wake = false;
+	list_add_tail(&sdev->wheel_node, &wheel->members);
+	sdev->wheel = wheel;
+	simtemp_wheel_arm(wheel);
+	mutex_unlock(&simtemp_wheel_lock);
+}
 
-	if (ret){
-		return ret;
+static void simtemp_wheel_leave(struct simtemp_device *sdev)
+{
+	struct simtemp_wheel *wheel = sdev->wheel;
+
+	mutex_lock(&simtemp_wheel_lock);
+	hrtimer_cancel(&wheel->timer);
+	list_del(&sdev->wheel_node);
+	sdev->wheel = NULL;
+	simtemp_wheel_arm(wheel); /* Stays cancelled once the last member left */
+	mutex_unlock(&simtemp_wheel_lock);
+}
+
+/*
+ * First deadline of a (re)started timer. By default the schedule starts over
+ * one period from now, or on the shared grid for a shared timer. With
+ * phase_continuous set it carries on from the last tick at the current
+ * period, so the stream stays evenly spaced across reconfiguration; ticks
+ * whose deadline passed while the timer was stopped are counted as missed.
+ */
+static u64 simtemp_timer_next(struct simtemp_device *sdev)
+{
+	u64 period = READ_ONCE(sdev->period_ns);
+	u64 last = sdev->last_expiry_ns;
+	u64 now = ktime_get_ns();
+	u64 next, missed;
+
+	if (!sdev->phase_continuous || !last){
+		return sdev->shared_timer ? simtemp_wheel_align(now, period) : now + period;
 	}
-	if (new_period < MIN_SAMPLING_MS || new_period > MAX_SAMPLING_MS){ /* Sanity check */
-		return -EINVAL;
+	next = last + period;
+	if (next <= now) {
+		missed = div64_u64(now - next, period) + 1;
+		next += missed * period;
+		WRITE_ONCE(sdev->reconfig_missed, sdev->reconfig_missed + missed);
 	}
+	return next;
+}
 
-	spin_lock_irqsave(&sdev->lock, flags);
-	sdev->sampling_ms = new_period;
-	hrtimer_start(&sdev->timer, ms_to_ktime(sdev->sampling_ms), HRTIMER_MODE_REL);
-	spin_unlock_irqrestore(&sdev->lock, flags);
-	pr_debug("nxp_simtemp - new_sampling: %u\n", sdev->sampling_ms);
+/*
+ * Starts whichever timer drives @sdev, which must be stopped, with its first
+ * tick at @next and the current period. Nothing is started while the device
+ * is runtime suspended. Called with cfg_lock held.
+ */
+static void simtemp_timer_start_at(struct simtemp_device *sdev, u64 next)
+{
+	if (sdev->idle){
+		return;
+	}
 
-	return count;
+	/* Until the first tick, the grid is anchored one period before it */
+	WRITE_ONCE(sdev->last_expiry_ns, next - READ_ONCE(sdev->period_ns));
+	if (!sdev->shared_timer) {
+		simtemp_hrtimer_start_on(&sdev->timer, ns_to_ktime(next), simtemp_slack_ns(sdev),
+					 simtemp_hrtimer_mode(sdev), sdev->cpu);
+		return;
+	}
+	if (sdev->wheel){
+		simtemp_wheel_leave(sdev);
+	}
+	simtemp_wheel_join(sdev, next);
 }
-static DEVICE_ATTR_RW(sampling_ms);
 
-/* threshold_mC (RW) */
-static ssize_t threshold_mC_show(struct device *dev, struct device_attribute *attr, char *buf)
+static void simtemp_timer_start(struct simtemp_device *sdev)
 {
-	struct simtemp_device *sdev = dev_get_drvdata(dev);
-	return sysfs_emit(buf, "%d\n", sdev->threshold_mC);
+	simtemp_timer_start_at(sdev, simtemp_timer_next(sdev));
 }
-static ssize_t threshold_mC_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+
+/* Afterwards no timer callback runs for @sdev */
+static void simtemp_timer_cancel(struct simtemp_device *sdev)
 {
-	struct simtemp_device *sdev = dev_get_drvdata(dev);
-	s32 new_thresh;
-	int ret = kstrtos32(buf, 10, &new_thresh);
-	unsigned long flags;
+	hrtimer_cancel(&sdev->timer);
+	if (sdev->wheel){
+		simtemp_wheel_leave(sdev);
+	}
+}
+
+/* Moves the running timer to a new period_ns. Called with cfg_lock held. */
+static void simtemp_timer_retime(struct simtemp_device *sdev)
+{
+	simtemp_timer_cancel(sdev);
+	simtemp_timer_start(sdev);
+}
+
+/* Emits the whole configuration after any part of it changed */
+static void simtemp_trace_config(struct simtemp_device *sdev)
+{
+	trace_simtemp_config_changed(sdev);
+}
+
+static int simtemp_set_aggregate(struct simtemp_device *sdev, u32 aggregate)
+{
+	unsigned long flags;
+	u64 period_ns;
+	bool retime;
+
+	if (aggregate < 1 || aggregate > MAX_AGGREGATE){
+		return -EINVAL;
+	}
+
+	mutex_lock(&sdev->cfg_lock);
+	spin_lock_irqsave(&sdev->lock, flags);
+	if (!simtemp_period_valid(sdev->sampling_us, aggregate)) {
+		spin_unlock_irqrestore(&sdev->lock, flags);
+		mutex_unlock(&sdev->cfg_lock);
+		return -EINVAL;
+	}
+	/* The producer notices the new factor and drops its partial window */
+	period_ns = sdev->period_ns;
+	WRITE_ONCE(sdev->aggregate, aggregate);
+	simtemp_update_period(sdev);
+	retime = sdev->period_ns != period_ns;
+	spin_unlock_irqrestore(&sdev->lock, flags);
+	if (retime){
+		simtemp_timer_retime(sdev);
+	}
+	mutex_unlock(&sdev->cfg_lock);
+	simtemp_trace_config(sdev);
+
+	return 0;
+}
+
+/* Re-arms the timer so the new slack range applies from the next tick */
+static int simtemp_set_timer_slack(struct simtemp_device *sdev, u32 slack_us)
+{
+	if (slack_us > MAX_TIMER_SLACK_US){
+		return -EINVAL;
+	}
+
+	mutex_lock(&sdev->cfg_lock);
+	if (slack_us != sdev->timer_slack_us) {
+		WRITE_ONCE(sdev->timer_slack_us, slack_us);
+		simtemp_timer_retime(sdev);
+	}
+	mutex_unlock(&sdev->cfg_lock);
+	simtemp_trace_config(sdev);
+
+	return 0;
+}
+
+/*
+ * Applies a new sampling period and, if @threshold_mC is not NULL, a new
+ * threshold in one step. Shared by the sysfs attributes and the ioctls.
+ */
+static int simtemp_set_config(struct simtemp_device *sdev, u32 sampling_us, const s32 *threshold_mC)
+{
+	unsigned long flags;
+	u64 period_ns;
+	bool retime;
+
+	if (sampling_us < MIN_SAMPLING_US || sampling_us > MAX_SAMPLING_US){
+		return -EINVAL;
+	}
+
+	mutex_lock(&sdev->cfg_lock);
+	spin_lock_irqsave(&sdev->lock, flags);
+	if (!simtemp_period_valid(sampling_us, sdev->aggregate)) {
+		spin_unlock_irqrestore(&sdev->lock, flags);
+		mutex_unlock(&sdev->cfg_lock);
+		return -EINVAL;
+	}
+	period_ns = sdev->period_ns;
+	WRITE_ONCE(sdev->sampling_us, sampling_us);
+	if (threshold_mC){
+		WRITE_ONCE(sdev->threshold_mC, *threshold_mC);
+	}
+	simtemp_update_period(sdev);
+	retime = sdev->period_ns != period_ns;
+	spin_unlock_irqrestore(&sdev->lock, flags);
+
+	/* Re-arm the timer only if the period changed, a restart is a gap in the stream */
+	if (retime){
+		simtemp_timer_retime(sdev);
+	}
+	mutex_unlock(&sdev->cfg_lock);
+	simtemp_trace_config(sdev);
+
+	return 0;
+}
+
+/* --- IIO Front-end --- */
+
+#if IS_REACHABLE(CONFIG_IIO_TRIGGERED_BUFFER)
+
+/*
+ * Every record the producer publishes fires the instance's own IIO trigger,
+ * so the triggered buffer runs at the record rate with no timer of its own.
+ * The record is handed over in two steps, each guarded by the stage after
+ * it: the producer only writes iio_temp_mC while iio_work is idle, and the
+ * trigger's top half only copies it into the scan while the previous scan
+ * has been pushed (an IIO trigger does not fire while its consumers are
+ * busy). Records arriving at a busy stage are not pushed to IIO.
+ */
+struct simtemp_iio {
+	struct simtemp_device *sdev;
+	struct {
+		s32 temp_mC;
+		s64 timestamp __aligned(8);
+	} scan;
+};
+
+static struct simtemp_device *simtemp_iio_sdev(struct iio_dev *indio_dev)
+{
+	return ((struct simtemp_iio *)iio_priv(indio_dev))->sdev;
+}
+
+/* Called from the producer only, for every record */
+static void simtemp_iio_push(struct simtemp_device *sdev, const struct simtemp_sample *sample)
+{
+	struct iio_dev *indio_dev = sdev->indio_dev;
+
+	WRITE_ONCE(sdev->last_temp_mC, sample->temp_mC);
+	if (!indio_dev || !iio_buffer_enabled(indio_dev) || irq_work_is_busy(&sdev->iio_work)){
+		return;
+	}
+	sdev->iio_temp_mC = sample->temp_mC;
+	sdev->iio_timestamp = iio_get_time_ns(indio_dev);
+	irq_work_queue(&sdev->iio_work);
+}
+
+/* iio_trigger_poll() needs hardirq context, which the producer may not be in */
+static void simtemp_iio_work(struct irq_work *work)
+{
+	struct simtemp_device *sdev = container_of(work, struct simtemp_device, iio_work);
+
+	iio_trigger_poll(sdev->iio_trig);
+}
+
+static irqreturn_t simtemp_iio_trigger_top(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct simtemp_iio *st = iio_priv(pf->indio_dev);
+
+	st->scan.temp_mC = st->sdev->iio_temp_mC;
+	st->scan.timestamp = st->sdev->iio_timestamp;
+	return IRQ_WAKE_THREAD;
+}
+
+static irqreturn_t simtemp_iio_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct simtemp_iio *st = iio_priv(indio_dev);
+
+	iio_push_to_buffers_with_timestamp(indio_dev, &st->scan, st->scan.timestamp);
+	iio_trigger_notify_done(indio_dev->trig);
+	return IRQ_HANDLED;
+}
+
+static int simtemp_iio_read_raw(struct iio_dev *indio_dev, struct iio_chan_spec const *chan,
+				int *val, int *val2, long mask)
+{
+	struct simtemp_device *sdev = simtemp_iio_sdev(indio_dev);
+	u32 sampling_us;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_RAW:
+		*val = READ_ONCE(sdev->last_temp_mC);
+		return IIO_VAL_INT;
+	case IIO_CHAN_INFO_SCALE:
+		/* Records are in milli degrees Celsius, the IIO unit for IIO_TEMP */
+		*val = 1;
+		return IIO_VAL_INT;
+	case IIO_CHAN_INFO_SAMP_FREQ:
+		/* Records per second, whatever the aggregation factor */
+		sampling_us = READ_ONCE(sdev->sampling_us);
+		*val = USEC_PER_SEC / sampling_us;
+		*val2 = div_u64((u64)(USEC_PER_SEC % sampling_us) * USEC_PER_SEC, sampling_us);
+		return IIO_VAL_INT_PLUS_MICRO;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int simtemp_iio_write_raw(struct iio_dev *indio_dev, struct iio_chan_spec const *chan,
+				 int val, int val2, long mask)
+{
+	u64 freq_uhz, sampling_us;
+
+	if (mask != IIO_CHAN_INFO_SAMP_FREQ || val < 0 || val2 < 0){
+		return -EINVAL;
+	}
+	freq_uhz = (u64)val * USEC_PER_SEC + val2;
+	if (!freq_uhz){
+		return -EINVAL;
+	}
+	sampling_us = div64_u64((u64)USEC_PER_SEC * USEC_PER_SEC, freq_uhz);
+	if (sampling_us > MAX_SAMPLING_US){
+		return -EINVAL;
+	}
+	return simtemp_set_config(simtemp_iio_sdev(indio_dev), sampling_us, NULL);
+}
+
+static const struct iio_info simtemp_iio_info = {
+	.read_raw = simtemp_iio_read_raw,
+	.write_raw = simtemp_iio_write_raw,
+	.validate_trigger = iio_validate_own_trigger,
+};
+
+static const struct iio_trigger_ops simtemp_iio_trigger_ops = {
+	.validate_device = iio_trigger_validate_own_device,
+};
+
+/* An enabled buffer is a reader like an open file: it keeps the timer running */
+static int simtemp_iio_buffer_preenable(struct iio_dev *indio_dev)
+{
+	return pm_runtime_resume_and_get(&simtemp_iio_sdev(indio_dev)->pdev->dev);
+}
+
+static int simtemp_iio_buffer_postdisable(struct iio_dev *indio_dev)
+{
+	struct device *dev = &simtemp_iio_sdev(indio_dev)->pdev->dev;
+
+	pm_runtime_mark_last_busy(dev);
+	pm_runtime_put_autosuspend(dev);
+	return 0;
+}
+
+static const struct iio_buffer_setup_ops simtemp_iio_buffer_ops = {
+	.preenable = simtemp_iio_buffer_preenable,
+	.postdisable = simtemp_iio_buffer_postdisable,
+};
+
+static const struct iio_chan_spec simtemp_iio_channels[] = {
+	{
+		.type = IIO_TEMP,
+		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW) | BIT(IIO_CHAN_INFO_SCALE),
+		.info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ),
+		.scan_index = 0,
+		.scan_type = {
+			.sign = 's',
+			.realbits = 32,
+			.storagebits = 32,
+			.endianness = IIO_CPU,
+		},
+	},
+	IIO_CHAN_SOFT_TIMESTAMP(1),
+};
+
+/*
+ * Registers the IIO device "simtemp<N>" and its trigger "simtemp<N>-record".
+ * Not devm: remove() must unregister them before sdev is freed.
+ */
+static int simtemp_iio_init(struct simtemp_device *sdev)
+{
+	struct device *dev = &sdev->pdev->dev;
+	struct iio_dev *indio_dev;
+	struct simtemp_iio *st;
+	int ret;
+
+	if (!iio){
+		return 0;
+	}
+
+	indio_dev = iio_device_alloc(dev, sizeof(*st));
+	if (!indio_dev){
+		return -ENOMEM;
+	}
+	st = iio_priv(indio_dev);
+	st->sdev = sdev;
+	indio_dev->name = sdev->miscdev.name;
+	indio_dev->info = &simtemp_iio_info;
+	indio_dev->modes = INDIO_DIRECT_MODE;
+	indio_dev->channels = simtemp_iio_channels;
+	indio_dev->num_channels = ARRAY_SIZE(simtemp_iio_channels);
+
+	sdev->iio_trig = iio_trigger_alloc(dev, "%s-record", sdev->miscdev.name);
+	if (!sdev->iio_trig) {
+		ret = -ENOMEM;
+		goto err_dev;
+	}
+	sdev->iio_trig->ops = &simtemp_iio_trigger_ops;
+	sdev->iio_work = IRQ_WORK_INIT_HARD(simtemp_iio_work);
+	ret = iio_trigger_register(sdev->iio_trig);
+	if (ret){
+		goto err_trig;
+	}
+
+	ret = iio_triggered_buffer_setup(indio_dev, simtemp_iio_trigger_top, simtemp_iio_trigger_handler,
+					 &simtemp_iio_buffer_ops);
+	if (ret){
+		goto err_trig_unregister;
+	}
+	ret = iio_device_register(indio_dev);
+	if (ret){
+		goto err_buffer;
+	}
+
+	/* Published last: the producer starts pushing once it sees indio_dev */
+	WRITE_ONCE(sdev->indio_dev, indio_dev);
+	return 0;
+
+err_buffer:
+	iio_triggered_buffer_cleanup(indio_dev);
+err_trig_unregister:
+	iio_trigger_unregister(sdev->iio_trig);
+err_trig:
+	iio_trigger_free(sdev->iio_trig);
+	sdev->iio_trig = NULL;
+err_dev:
+	iio_device_free(indio_dev);
+	return ret;
+}
+
+/* Called once the timer is stopped for good */
+static void simtemp_iio_exit(struct simtemp_device *sdev)
+{
+	struct iio_dev *indio_dev = sdev->indio_dev;
+
+	if (!indio_dev){
+		return;
+	}
+	iio_device_unregister(indio_dev);
+	irq_work_sync(&sdev->iio_work);
+	iio_triggered_buffer_cleanup(indio_dev);
+	iio_trigger_unregister(sdev->iio_trig);
+	iio_trigger_free(sdev->iio_trig);
+	iio_device_free(indio_dev);
+	sdev->indio_dev = NULL;
+}
+
+#else
+
+static void simtemp_iio_push(struct simtemp_device *sdev, const struct simtemp_sample *sample)
+{
+}
+
+static int simtemp_iio_init(struct simtemp_device *sdev)
+{
+	return 0;
+}
+
+static void simtemp_iio_exit(struct simtemp_device *sdev)
+{
+}
+
+#endif
+
+/* --- Sample Production --- */
+
+/* Called from the producer only, for every sample that counts as an alert */
+static void simtemp_event_push(struct simtemp_device *sdev, const struct simtemp_sample *sample)
+{
+	u64 head = sdev->event_head;
+	struct simtemp_event *ev = &sdev->events[head & (EVENT_SLOTS - 1)];
+
+	/* Same publication protocol as simtemp_hist_push() */
+	smp_wmb();
+	ev->timestamp_ns = sample->timestamp_ns;
+	ev->seq = head;
+	ev->temp_mC = sample->temp_mC;
+	ev->threshold_mC = READ_ONCE(sdev->threshold_mC);
+	ev->flags = sample->flags & (SIMTEMP_FLAG_THRESHOLD_CROSSED | SIMTEMP_FLAG_THRESHOLD_RISING |
+				     SIMTEMP_FLAG_THRESHOLD_FALLING);
+	ev->reserved = 0;
+	smp_store_release(&sdev->event_head, head + 1);
+
+	/* Events are rare: wake their readers right away instead of batching like data */
+	wake_up_interruptible(&sdev->event_wq);
+}
+
+/*
+ * Tracks the alarm state of @sample and sets its threshold flags. The alarm
+ * is raised when temp_mC reaches threshold_mC and only cleared once it drops
+ * below threshold_mC - hysteresis_mC, so noise around the threshold does not
+ * toggle it. Returns true if the sample should count as an alert.
+ */
+static bool simtemp_alert_update(struct simtemp_device *sdev, struct simtemp_sample *sample)
+{
+	s32 threshold = READ_ONCE(sdev->threshold_mC);
+	s64 clear = (s64)threshold - READ_ONCE(sdev->hysteresis_mC);
+	bool edge = false;
+
+	if (!sdev->alert_active && sample->temp_mC >= threshold) {
+		sdev->alert_active = true;
+		sample->flags |= SIMTEMP_FLAG_THRESHOLD_RISING;
+		edge = true;
+	} else if (sdev->alert_active && sample->temp_mC < clear) {
+		sdev->alert_active = false;
+		sample->flags |= SIMTEMP_FLAG_THRESHOLD_FALLING;
+		edge = true;
+	}
+	if (sdev->alert_active){
+		sample->flags |= SIMTEMP_FLAG_THRESHOLD_CROSSED;
+	}
+	if (edge){
+		trace_simtemp_threshold_crossed(sdev->id, sample->timestamp_ns, sample->temp_mC,
+						threshold, sdev->alert_active);
+	}
+
+	if (READ_ONCE(sdev->alert_mode) == ALERT_EDGE){
+		return edge;
+	}
+	return sdev->alert_active;
+}
+
+/*
+ * Wakeup coalescing: readers are woken once wake_watermark records have been
+ * published since the last wakeup, or once the oldest of them has waited
+ * wake_timeout_us. This is checked on every raw sample, so the timeout has the
+ * resolution of the raw sampling period.
+ */
+static bool simtemp_wake_due(struct simtemp_device *sdev)
+{
+	u64 queued = sdev->hist_head - sdev->wake_seq;
+	u32 timeout_us = READ_ONCE(sdev->wake_timeout_us);
+	u64 oldest_ns;
+
+	if (!queued){
+		return false;
+	}
+	/* Also wake before the oldest unwoken record is overwritten */
+	if (queued >= min(READ_ONCE(sdev->wake_watermark), sdev->fifo_depth)){
+		return true;
+	}
+	if (!timeout_us){
+		return false;
+	}
+	oldest_ns = sdev->hist_enq_ns[sdev->wake_seq & (sdev->fifo_depth - 1)];
+	return ktime_get_ns() - oldest_ns >= (u64)timeout_us * NSEC_PER_USEC;
+}
+
+/*
+ * Generates one raw sample taken at @timestamp_ns and publishes any resulting
+ * record. Returns true if readers need a wakeup: enough records are queued
+ * (see simtemp_wake_due()), this sample raised an alert, or a non-looping
+ * replay just ended.
+ */
+static bool simtemp_produce(struct simtemp_device *sdev, u64 timestamp_ns)
+{
+    struct simtemp_sample sample;
+	struct simtemp_summary rec;
+	u64 start_ns;
+	bool alert;
+
+	/* A replay played once keeps the timer running but produces nothing more */
+	if (unlikely(sdev->wave_done) && simtemp_mode_is_table(READ_ONCE(sdev->mode))){
+		return false;
+	}
+	start_ns = ktime_get_ns();
+
+	sample.timestamp_ns = timestamp_ns;
+	sample.temp_mC = generate_temp(sdev);
+	sample.flags = SIMTEMP_FLAG_NEW_SAMPLE;
+
+	/* Single producer: no lock, only atomic counters and release stores */
+	atomic64_inc(&sdev->update_count);
+	alert = simtemp_alert_update(sdev, &sample);
+	if (alert){
+		atomic64_inc(&sdev->alert_count);
+		simtemp_event_push(sdev, &sample);
+	}
+	trace_simtemp_sample_generated(sdev->id, atomic64_read(&sdev->update_count),
+				       timestamp_ns, sample.temp_mC, sample.flags);
+
+	/* In aggregation mode only every Nth raw sample produces a record */
+	if (simtemp_agg_add(sdev, &sample, &rec)) {
+		simtemp_hist_push(sdev, &rec);
+		simtemp_ring_push(sdev, &rec.sample);
+		simtemp_iio_push(sdev, &rec.sample);
+	}
+
+	WRITE_ONCE(sdev->produce_ns, sdev->produce_ns + ktime_get_ns() - start_ns);
+
+	/*
+	 * Alerts are not coalesced, so EPOLLPRI is delivered right away. After
+	 * the last entry of a replay no tick produces again, so flush the rest.
+	 */
+	if (unlikely(sdev->wave_done) && sdev->hist_head != sdev->wake_seq){
+		return true;
+	}
+	return alert || simtemp_wake_due(sdev);
+}
+
+/* PRODUCER_HARDIRQ and PRODUCER_SOFTIRQ: the whole sample is produced here */
+static enum hrtimer_restart simtemp_timer_callback(struct hrtimer *timer)
+{
+    struct simtemp_device *sdev = container_of(timer, struct simtemp_device, timer);
+
+	if (simtemp_produce(sdev, simtemp_clock_read(READ_ONCE(sdev->ts_clock)))){
+		simtemp_wake_readers(sdev);
+	}
+
+    /* Reschedule the timer */
+	simtemp_timer_forward(sdev, timer);
+
+	return HRTIMER_RESTART;
+}
+
+/*
+ * PRODUCER_THREAD: the hardirq part only records when the sample was taken
+ * and kicks the producer thread. No locks are taken here.
+ */
+static void simtemp_defer(struct simtemp_device *sdev, u64 timestamp_ns)
+{
+	unsigned int head = sdev->defer_head;
+
+	if (head - smp_load_acquire(&sdev->defer_tail) < DEFER_SLOTS) {
+		sdev->defer_ts[head & (DEFER_SLOTS - 1)] = timestamp_ns;
+		smp_store_release(&sdev->defer_head, head + 1);
+	} else {
+		WRITE_ONCE(sdev->defer_drops, sdev->defer_drops + 1);
+		trace_simtemp_sample_dropped(sdev->id, SIMTEMP_DROP_DEFER, 1);
+	}
+	wake_up_process(sdev->producer_task);
+}
+
+static enum hrtimer_restart simtemp_defer_callback(struct hrtimer *timer)
+{
+    struct simtemp_device *sdev = container_of(timer, struct simtemp_device, timer);
+
+	simtemp_defer(sdev, simtemp_clock_read(READ_ONCE(sdev->ts_clock)));
+
+	simtemp_timer_forward(sdev, timer);
+
+	return HRTIMER_RESTART;
+}
+
+static int simtemp_producer_thread(void *data)
+{
+	struct simtemp_device *sdev = data;
+	unsigned int tail;
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop()){
+			break;
+		}
+		if (kthread_should_park()) {
+			__set_current_state(TASK_RUNNING);
+			kthread_parkme();
+			continue;
+		}
+
+		tail = sdev->defer_tail;
+		if (tail == smp_load_acquire(&sdev->defer_head)) {
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		if (simtemp_produce(sdev, sdev->defer_ts[tail & (DEFER_SLOTS - 1)])){
+			simtemp_wake_readers(sdev);
+		}
+		smp_store_release(&sdev->defer_tail, tail + 1);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+/* One tick of the shared timer, returns true if readers need a wakeup */
+static bool simtemp_tick(struct simtemp_device *sdev, u64 timestamp_ns)
+{
+	if (sdev->producer == PRODUCER_THREAD) {
+		simtemp_defer(sdev, timestamp_ns);
+		return false; /* The producer thread wakes the readers */
+	}
+	return simtemp_produce(sdev, timestamp_ns);
+}
+
+static void simtemp_timer_setup(struct simtemp_device *sdev)
+{
+	/*
+	 * PRODUCER_HARDIRQ keeps plain HRTIMER_MODE_ABS: its callback wakes the
+	 * readers' wait queue, whose spinlock_t sleeps on PREEMPT_RT, so RT must
+	 * be able to move it to softirq. The deferred callback only calls
+	 * wake_up_process() and is forced to hardirq to keep its timestamp tight.
+	 */
+	hrtimer_init(&sdev->timer, CLOCK_MONOTONIC, simtemp_hrtimer_mode(sdev));
+	sdev->timer.function = sdev->producer == PRODUCER_THREAD ? &simtemp_defer_callback : &simtemp_timer_callback;
+}
+
+/* Keeps the producer thread on the instance's CPU, or lets it run anywhere */
+static void simtemp_producer_affine(struct simtemp_device *sdev, struct task_struct *task)
+{
+	set_cpus_allowed_ptr(task, sdev->cpu >= 0 ? cpumask_of(sdev->cpu) : cpu_possible_mask);
+}
+
+/* Stops the timer, switches where samples are generated and restarts it */
+static int simtemp_set_producer(struct simtemp_device *sdev, enum simtemp_producer producer)
+{
+	struct task_struct *task = NULL;
+
+	mutex_lock(&sdev->cfg_lock);
+	if (producer == sdev->producer) {
+		mutex_unlock(&sdev->cfg_lock);
+		return 0;
+	}
+
+	if (producer == PRODUCER_THREAD) {
+		task = kthread_create(simtemp_producer_thread, sdev, "%s-producer", sdev->miscdev.name);
+		if (IS_ERR(task)) {
+			mutex_unlock(&sdev->cfg_lock);
+			return PTR_ERR(task);
+		}
+		sched_set_fifo_low(task);
+		simtemp_producer_affine(sdev, task);
+	}
+
+	/* The callback may be running, so this must happen outside sdev->lock */
+	simtemp_timer_cancel(sdev);
+	if (sdev->producer_task) {
+		kthread_stop(sdev->producer_task);
+		sdev->producer_task = NULL;
+	}
+
+	sdev->producer = producer;
+	sdev->producer_task = task;
+	sdev->defer_head = 0;
+	sdev->defer_tail = 0;
+	if (task){
+		wake_up_process(task);
+	}
+
+	simtemp_timer_setup(sdev);
+	simtemp_timer_start(sdev);
+	mutex_unlock(&sdev->cfg_lock);
+	simtemp_trace_config(sdev);
+
+	return 0;
+}
+
+/*
+ * Quiesces the producer: afterwards neither the timer callback nor the
+ * producer thread touches the rings until simtemp_producer_resume().
+ * Called with cfg_lock held.
+ */
+static void simtemp_producer_pause(struct simtemp_device *sdev)
+{
+	simtemp_timer_cancel(sdev);
+	if (sdev->producer_task){
+		kthread_park(sdev->producer_task);
+	}
+}
+
+static void simtemp_producer_resume(struct simtemp_device *sdev)
+{
+	if (sdev->producer_task){
+		kthread_unpark(sdev->producer_task);
+	}
+	simtemp_timer_start(sdev);
+}
+
+/*
+ * Moves the history into the buffers passed in, sized for @depth records.
+ * The newest samples are carried over at the same sequence numbers, so
+ * reader cursors stay valid and a shrink simply shows up as an overrun for
+ * readers that were further behind. The old buffers are handed back in the
+ * same arguments for the caller to free. Called with the producer paused.
+ */
+static void simtemp_hist_swap(struct simtemp_device *sdev, u32 depth, struct simtemp_sample **hist,
+			      struct simtemp_summary **hist_sum, u64 **enq_ns)
+{
+	struct simtemp_sample *old_hist;
+	struct simtemp_summary *old_sum;
+	u64 *old_enq;
+	u32 old_depth;
+	u64 seq, keep;
+
+	down_write(&sdev->hist_rwsem);
+
+	old_hist = sdev->hist;
+	old_sum = sdev->hist_sum;
+	old_enq = sdev->hist_enq_ns;
+	old_depth = sdev->fifo_depth;
+	keep = min3(sdev->hist_head, (u64)old_depth - 1, (u64)depth - 1);
+	for (seq = sdev->hist_head - keep; seq != sdev->hist_head; seq++) {
+		(*hist)[seq & (depth - 1)] = old_hist[seq & (old_depth - 1)];
+		(*hist_sum)[seq & (depth - 1)] = old_sum[seq & (old_depth - 1)];
+		(*enq_ns)[seq & (depth - 1)] = old_enq[seq & (old_depth - 1)];
+	}
+
+	sdev->hist = *hist;
+	sdev->hist_sum = *hist_sum;
+	sdev->hist_enq_ns = *enq_ns;
+	WRITE_ONCE(sdev->fifo_depth, depth);
+
+	up_write(&sdev->hist_rwsem);
+
+	*hist = old_hist;
+	*hist_sum = old_sum;
+	*enq_ns = old_enq;
+}
+
+/* Replaces the history ring, see simtemp_hist_swap() */
+static int simtemp_hist_resize(struct simtemp_device *sdev, u32 depth)
+{
+	struct simtemp_sample *hist;
+	struct simtemp_summary *hist_sum;
+	u64 *enq_ns;
+	int ret;
+
+	lockdep_assert_held(&sdev->cfg_lock);
+
+	ret = simtemp_hist_alloc(sdev, depth, &hist, &hist_sum, &enq_ns);
+	if (ret){
+		return ret;
+	}
+
+	simtemp_producer_pause(sdev);
+	simtemp_hist_swap(sdev, depth, &hist, &hist_sum, &enq_ns);
+	simtemp_producer_resume(sdev);
+
+	kvfree(hist);
+	kvfree(hist_sum);
+	kvfree(enq_ns);
+
+	return 0;
+}
+
+static int simtemp_set_fifo_depth(struct simtemp_device *sdev, u32 depth)
+{
+	int ret;
+
+	ret = simtemp_fifo_depth_check(&depth);
+	if (ret){
+		return ret;
+	}
+
+	mutex_lock(&sdev->cfg_lock);
+	if (depth != sdev->fifo_depth){
+		ret = simtemp_hist_resize(sdev, depth);
+	}
+	mutex_unlock(&sdev->cfg_lock);
+	if (!ret){
+		simtemp_trace_config(sdev);
+	}
+
+	return ret;
+}
+
+/* Reader wakeup coalescing, see simtemp_wake_due() */
+static int simtemp_set_wakeup(struct simtemp_device *sdev, u32 watermark, u32 timeout_us)
+{
+	if (watermark < 1 || watermark > MAX_FIFO_DEPTH || timeout_us > MAX_SAMPLING_US){
+		return -EINVAL;
+	}
+	/* Read locklessly by the producer; a mixed pair for one tick is harmless */
+	mutex_lock(&sdev->cfg_lock);
+	WRITE_ONCE(sdev->wake_watermark, watermark);
+	WRITE_ONCE(sdev->wake_timeout_us, timeout_us);
+	mutex_unlock(&sdev->cfg_lock);
+	simtemp_trace_config(sdev);
+
+	return 0;
+}
+
+/*
+ * Makes @wave the current table (NULL keeps the current one), restarts it
+ * from entry 0 and switches to @mode. Called with the producer paused, so it
+ * never sees a table and position that do not match. Returns the replaced
+ * table for the caller to free.
+ */
+static struct simtemp_wave *simtemp_wave_switch(struct simtemp_device *sdev, enum simtemp_mode mode,
+						struct simtemp_wave *wave)
+{
+	struct simtemp_wave *old = NULL;
+
+	if (wave) {
+		old = sdev->wave;
+		sdev->wave = wave;
+	}
+	sdev->wave_pos = 0;
+	sdev->wave_done = false;
+	WRITE_ONCE(sdev->mode, mode);
+
+	return old;
+}
+
+static void simtemp_wave_install(struct simtemp_device *sdev, enum simtemp_mode mode, struct simtemp_wave *wave)
+{
+	lockdep_assert_held(&sdev->cfg_lock);
+
+	simtemp_producer_pause(sdev);
+	wave = simtemp_wave_switch(sdev, mode, wave);
+	simtemp_producer_resume(sdev);
+
+	kvfree(wave);
+}
+
+static int simtemp_set_mode(struct simtemp_device *sdev, enum simtemp_mode mode)
+{
+	struct simtemp_wave *wave = NULL;
+	unsigned long flags;
+	int ret = 0;
+
+	if (mode == MODE_SINE || mode == MODE_SQUARE) {
+		wave = simtemp_wave_build(mode, READ_ONCE(sdev->wave_len), READ_ONCE(sdev->wave_amplitude_mC));
+		if (!wave){
+			return -ENOMEM;
+		}
+	}
+
+	mutex_lock(&sdev->cfg_lock);
+	if (mode == MODE_PROFILE || mode == MODE_REPLAY) {
+		/* Re-selects the last upload from the start, if it was not replaced since */
+		if (sdev->wave && sdev->wave->mode == mode){
+			simtemp_wave_install(sdev, mode, NULL);
+		} else {
+			ret = -ENODATA;
+		}
+	} else if (wave) {
+		simtemp_wave_install(sdev, mode, wave);
+	} else {
+		spin_lock_irqsave(&sdev->lock, flags);
+		if (mode == MODE_RAMP){
+			WRITE_ONCE(sdev->ramp_temp, 25000); /* Reset ramp on mode set */
+		}
+		WRITE_ONCE(sdev->mode, mode);
+		spin_unlock_irqrestore(&sdev->lock, flags);
+	}
+	mutex_unlock(&sdev->cfg_lock);
+	if (!ret){
+		simtemp_trace_config(sdev);
+	}
+
+	return ret;
+}
+
+/* Rebuilds the current sine/square table after its shape changed */
+static int simtemp_set_wave(struct simtemp_device *sdev, u32 len, s32 amplitude_mC)
+{
+	enum simtemp_mode mode;
+
+	if (len < MIN_WAVE_LEN || len > MAX_WAVE_LEN || amplitude_mC < 0 || amplitude_mC > 100000){
+		return -EINVAL;
+	}
+	WRITE_ONCE(sdev->wave_len, len);
+	WRITE_ONCE(sdev->wave_amplitude_mC, amplitude_mC);
+
+	mode = READ_ONCE(sdev->mode);
+	if (mode == MODE_SINE || mode == MODE_SQUARE){
+		return simtemp_set_mode(sdev, mode);
+	}
+	return 0;
+}
+
+/* Uploads @count temperatures from user space and starts replaying them */
+static int simtemp_set_profile(struct simtemp_device *sdev, const struct simtemp_profile *profile)
+{
+	struct simtemp_wave *wave;
+
+	if (profile->count < 1 || profile->count > MAX_WAVE_LEN || profile->reserved){
+		return -EINVAL;
+	}
+	wave = simtemp_wave_alloc(MODE_PROFILE, profile->count, true);
+	if (!wave){
+		return -ENOMEM;
+	}
+	if (copy_from_user(wave->temp_mC, u64_to_user_ptr(profile->temps_mC), profile->count * sizeof(s32))) {
+		kvfree(wave);
+		return -EFAULT;
+	}
+
+	mutex_lock(&sdev->cfg_lock);
+	simtemp_wave_install(sdev, MODE_PROFILE, wave);
+	mutex_unlock(&sdev->cfg_lock);
+	simtemp_trace_config(sdev);
+
+	return 0;
+}
+
+/*
+ * Starts a trace upload on @sfile: the next write()s on it fill @replay->count
+ * temperatures and the last one starts playback. Replaces an unfinished upload.
+ * Unfinished uploads of all files on the device share MAX_REPLAY_PENDING.
+ */
+static int simtemp_replay_begin(struct simtemp_file *sfile, const struct simtemp_replay *replay)
+{
+	struct simtemp_device *sdev = sfile->sdev;
+	struct simtemp_wave *wave;
+	u32 old_len;
+
+	if (replay->count < 1 || replay->count > MAX_REPLAY_LEN ||
+	    (replay->flags & ~SIMTEMP_REPLAY_LOOP) || replay->reserved){
+		return -EINVAL;
+	}
+
+	mutex_lock(&sfile->upload_lock);
+	old_len = sfile->replay ? sfile->replay->len : 0;
+	if (atomic_add_return(replay->count, &sdev->replay_pending) - old_len > MAX_REPLAY_PENDING){
+		atomic_sub(replay->count, &sdev->replay_pending);
+		mutex_unlock(&sfile->upload_lock);
+		return -EBUSY;
+	}
+	wave = simtemp_wave_alloc(MODE_REPLAY, replay->count, replay->flags & SIMTEMP_REPLAY_LOOP);
+	if (!wave){
+		atomic_sub(replay->count, &sdev->replay_pending);
+		mutex_unlock(&sfile->upload_lock);
+		return -ENOMEM;
+	}
+	kvfree(sfile->replay);
+	atomic_sub(old_len, &sdev->replay_pending);
+	sfile->replay = wave;
+	sfile->replay_off = 0;
+	mutex_unlock(&sfile->upload_lock);
+
+	return 0;
+}
+
+/*
+ * Applies a whole struct simtemp_config_ext. Everything is validated and
+ * allocated first; then the producer is paused once, all fields change
+ * together and the timer restarts once. A mode or FIFO depth equal to the
+ * current one is left alone, so writing back what GET returned neither
+ * restarts the waveform nor reallocates the history.
+ */
+static int simtemp_set_config_ext(struct simtemp_device *sdev, const struct simtemp_config_ext *cfg)
+{
+	struct simtemp_sample *hist = NULL;
+	struct simtemp_summary *hist_sum = NULL;
+	u64 *enq_ns = NULL;
+	struct simtemp_wave *wave = NULL;
+	u32 depth = cfg->fifo_depth;
+	bool mode_change, pause, retime;
+	unsigned long flags;
+	u64 period_ns;
+	int ret;
+
+	if (cfg->flags || cfg->reserved ||
+	    cfg->sampling_us < MIN_SAMPLING_US || cfg->sampling_us > MAX_SAMPLING_US ||
+	    cfg->aggregate < 1 || cfg->aggregate > MAX_AGGREGATE ||
+	    !simtemp_period_valid(cfg->sampling_us, cfg->aggregate) ||
+	    cfg->hysteresis_mC < 0 || cfg->hysteresis_mC > MAX_HYSTERESIS_MC ||
+	    cfg->mode >= MODE_MAX || cfg->alert_mode >= ALERT_MODE_MAX ||
+	    cfg->wake_watermark < 1 || cfg->wake_watermark > MAX_FIFO_DEPTH ||
+	    cfg->wake_timeout_us > MAX_SAMPLING_US){
+		return -EINVAL;
+	}
+	ret = simtemp_fifo_depth_check(&depth);
+	if (ret){
+		return ret;
+	}
+
+	mutex_lock(&sdev->cfg_lock);
+	mode_change = cfg->mode != sdev->mode;
+	if (mode_change) {
+		if (cfg->mode == MODE_SINE || cfg->mode == MODE_SQUARE) {
+			wave = simtemp_wave_build(cfg->mode, sdev->wave_len, sdev->wave_amplitude_mC);
+			if (!wave) {
+				ret = -ENOMEM;
+				goto unlock;
+			}
+		} else if ((cfg->mode == MODE_PROFILE || cfg->mode == MODE_REPLAY) &&
+			   !(sdev->wave && sdev->wave->mode == cfg->mode)) {
+			ret = -ENODATA;
+			goto unlock;
+		}
+	}
+	if (depth != sdev->fifo_depth) {
+		ret = simtemp_hist_alloc(sdev, depth, &hist, &hist_sum, &enq_ns);
+		if (ret){
+			goto unlock;
+		}
+	}
+
+	/* Nothing can fail from here on. Only buffer and table swaps stop the producer. */
+	pause = hist || mode_change;
+	if (pause){
+		simtemp_producer_pause(sdev);
+	}
+	if (hist){
+		simtemp_hist_swap(sdev, depth, &hist, &hist_sum, &enq_ns);
+	}
+	if (mode_change) {
+		if (cfg->mode == MODE_RAMP){
+			sdev->ramp_temp = 25000;
+		}
+		wave = simtemp_wave_switch(sdev, cfg->mode, wave);
+	}
+
+	spin_lock_irqsave(&sdev->lock, flags);
+	period_ns = sdev->period_ns;
+	WRITE_ONCE(sdev->sampling_us, cfg->sampling_us);
+	WRITE_ONCE(sdev->threshold_mC, cfg->threshold_mC);
+	WRITE_ONCE(sdev->aggregate, cfg->aggregate);
+	simtemp_update_period(sdev);
+	retime = sdev->period_ns != period_ns;
+	spin_unlock_irqrestore(&sdev->lock, flags);
+	WRITE_ONCE(sdev->hysteresis_mC, cfg->hysteresis_mC);
+	WRITE_ONCE(sdev->alert_mode, cfg->alert_mode);
+	WRITE_ONCE(sdev->wake_watermark, cfg->wake_watermark);
+	WRITE_ONCE(sdev->wake_timeout_us, cfg->wake_timeout_us);
+	if (pause){
+		simtemp_producer_resume(sdev);
+	} else if (retime){
+		simtemp_timer_retime(sdev);
+	}
+
+unlock:
+	mutex_unlock(&sdev->cfg_lock);
+	/* Whatever was replaced, or was allocated for nothing on an error */
+	kvfree(hist);
+	kvfree(hist_sum);
+	kvfree(enq_ns);
+	kvfree(wave);
+	if (!ret){
+		simtemp_trace_config(sdev);
+	}
+
+	return ret;
+}
+
+static void simtemp_get_config_ext(struct simtemp_device *sdev, struct simtemp_config_ext *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+
+	/* Every writer of these fields holds cfg_lock, so none changes halfway */
+	mutex_lock(&sdev->cfg_lock);
+	cfg->sampling_us = READ_ONCE(sdev->sampling_us);
+	cfg->threshold_mC = READ_ONCE(sdev->threshold_mC);
+	cfg->hysteresis_mC = READ_ONCE(sdev->hysteresis_mC);
+	cfg->mode = READ_ONCE(sdev->mode);
+	cfg->fifo_depth = READ_ONCE(sdev->fifo_depth);
+	cfg->wake_watermark = READ_ONCE(sdev->wake_watermark);
+	cfg->wake_timeout_us = READ_ONCE(sdev->wake_timeout_us);
+	cfg->aggregate = READ_ONCE(sdev->aggregate);
+	cfg->alert_mode = READ_ONCE(sdev->alert_mode);
+	mutex_unlock(&sdev->cfg_lock);
+}
+
+/* Fills @snap for the file @sfile, see struct simtemp_snapshot */
+static void simtemp_get_snapshot(struct simtemp_file *sfile, struct simtemp_snapshot *snap)
+{
+	struct simtemp_device *sdev = sfile->sdev;
+	int cpu;
+
+	memset(snap, 0, sizeof(*snap));
+
+	/* One cfg_lock section: no config change lands between the fields */
+	mutex_lock(&sdev->cfg_lock);
+	snap->timestamp_ns = ktime_get_ns();
+	snap->sampling_us = READ_ONCE(sdev->sampling_us);
+	snap->threshold_mC = READ_ONCE(sdev->threshold_mC);
+	snap->hysteresis_mC = READ_ONCE(sdev->hysteresis_mC);
+	snap->mode = READ_ONCE(sdev->mode);
+	snap->fifo_depth = READ_ONCE(sdev->fifo_depth);
+	snap->wake_watermark = READ_ONCE(sdev->wake_watermark);
+	snap->wake_timeout_us = READ_ONCE(sdev->wake_timeout_us);
+	snap->aggregate = READ_ONCE(sdev->aggregate);
+	snap->alert_mode = READ_ONCE(sdev->alert_mode);
+	snap->cpu = sdev->cpu;
+
+	snap->updates = atomic64_read(&sdev->update_count);
+	snap->alerts = atomic64_read(&sdev->alert_count);
+	for_each_possible_cpu(cpu){
+		snap->dropped += *per_cpu_ptr(sdev->dropped, cpu);
+	}
+	snap->defer_drops = READ_ONCE(sdev->defer_drops);
+	snap->timer_ticks = READ_ONCE(sdev->timer_ticks);
+	snap->timer_overruns = READ_ONCE(sdev->timer_overruns);
+	snap->hist_head = smp_load_acquire(&sdev->hist_head);
+	snap->fifo_hwm = atomic64_read(&sdev->fifo_hwm);
+	/* The file's own read position, without waiting for a read() in progress */
+	snap->pending = min_t(u64, snap->hist_head - READ_ONCE(sfile->cursor), snap->fifo_depth - 1);
+	snap->overruns = READ_ONCE(sfile->overruns);
+	snap->last_error = READ_ONCE(sdev->last_error);
+	snap->alert_active = READ_ONCE(sdev->alert_active);
+	mutex_unlock(&sdev->cfg_lock);
+}
+
+/*
+ * Restarts the simulated stream: PRNG, ramp and table position. With the
+ * same seed and configuration the same sequence of temperatures follows.
+ */
+static void simtemp_set_seed(struct simtemp_device *sdev, u64 seed)
+{
+	mutex_lock(&sdev->cfg_lock);
+	simtemp_producer_pause(sdev);
+	simtemp_rng_seed(sdev, seed);
+	sdev->ramp_temp = 25000;
+	sdev->wave_pos = 0;
+	sdev->wave_done = false;
+	simtemp_producer_resume(sdev);
+	mutex_unlock(&sdev->cfg_lock);
+}
+
+/* Pins the timer and producer thread to @cpu (-1 for any) and moves the history to its node */
+static int simtemp_set_cpu(struct simtemp_device *sdev, int cpu)
+{
+	if (cpu < -1 || cpu >= (int)nr_cpu_ids || (cpu >= 0 && !cpu_online(cpu))){
+		return -EINVAL;
+	}
+
+	mutex_lock(&sdev->cfg_lock);
+	if (cpu == sdev->cpu) {
+		mutex_unlock(&sdev->cfg_lock);
+		return 0;
+	}
+
+	WRITE_ONCE(sdev->cpu, cpu);
+	if (sdev->producer_task){
+		simtemp_producer_affine(sdev, sdev->producer_task);
+	}
+	/* Reallocating pauses and resumes the producer, which re-arms the timer on @cpu */
+	if (simtemp_hist_resize(sdev, sdev->fifo_depth)) {
+		/* Out of memory: keep the old buffers but still move the timer */
+		simtemp_producer_pause(sdev);
+		simtemp_producer_resume(sdev);
+	}
+	mutex_unlock(&sdev->cfg_lock);
+	simtemp_trace_config(sdev);
+
+	return 0;
+}
+
+/* --- Sysfs Attributes --- */
+
+/* sampling_ms (RW): legacy millisecond view of sampling_us */
+static ssize_t sampling_ms_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%u\n", (u32)(READ_ONCE(sdev->sampling_us) / USEC_PER_MSEC));
+}
+static ssize_t sampling_ms_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	u32 new_period;
+	int ret = kstrtou32(buf, 10, &new_period);
+
+	if (ret){
+		return ret;
+	}
+	if (new_period < MIN_SAMPLING_MS || new_period > MAX_SAMPLING_MS){ /* Sanity check */
+		return -EINVAL;
+	}
+
+	ret = simtemp_set_config(sdev, new_period * USEC_PER_MSEC, NULL);
+	if (ret){
+		return ret;
+	}
+	return count;
+}
+static DEVICE_ATTR_RW(sampling_ms);
+
+/* sampling_us (RW) */
+static ssize_t sampling_us_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%u\n", READ_ONCE(sdev->sampling_us));
+}
+static ssize_t sampling_us_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	u32 new_period;
+	int ret = kstrtou32(buf, 10, &new_period);
+
+	if (ret){
+		return ret;
+	}
+	ret = simtemp_set_config(sdev, new_period, NULL);
+	if (ret){
+		return ret;
+	}
+	return count;
+}
+static DEVICE_ATTR_RW(sampling_us);
+
+/* threshold_mC (RW) */
+static ssize_t threshold_mC_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%d\n", sdev->threshold_mC);
+}
+static ssize_t threshold_mC_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	s32 new_thresh;
+	int ret = kstrtos32(buf, 10, &new_thresh);
+	unsigned long flags;
+
+	if (ret){
+		return ret;
+	}
+	mutex_lock(&sdev->cfg_lock);
+	spin_lock_irqsave(&sdev->lock, flags);
+	WRITE_ONCE(sdev->threshold_mC, new_thresh);
+	spin_unlock_irqrestore(&sdev->lock, flags);
+	mutex_unlock(&sdev->cfg_lock);
+	simtemp_trace_config(sdev);
+
+	return count;
+}
+static DEVICE_ATTR_RW(threshold_mC);
+
+/* hysteresis_mC (RW): how far below threshold_mC the alarm clears */
+static ssize_t hysteresis_mC_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%d\n", READ_ONCE(sdev->hysteresis_mC));
+}
+static ssize_t hysteresis_mC_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	s32 hyst;
+	int ret = kstrtos32(buf, 10, &hyst);
+
+	if (ret){
+		return ret;
+	}
+	if (hyst < 0 || hyst > MAX_HYSTERESIS_MC){
+		return -EINVAL;
+	}
+	mutex_lock(&sdev->cfg_lock);
+	WRITE_ONCE(sdev->hysteresis_mC, hyst);
+	mutex_unlock(&sdev->cfg_lock);
+	simtemp_trace_config(sdev);
+
+	return count;
+}
+static DEVICE_ATTR_RW(hysteresis_mC);
+
+/* alert_mode (RW): "level" raises EPOLLPRI for every alarm sample, "edge" only on transitions */
+static const char *const simtemp_alert_mode_str[] = { "level", "edge" };
+static ssize_t alert_mode_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%s\n", simtemp_alert_mode_str[READ_ONCE(sdev->alert_mode)]);
+}
+static ssize_t alert_mode_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	int i;
+
+	for (i = 0; i < ALERT_MODE_MAX; i++) {
+		if (sysfs_streq(buf, simtemp_alert_mode_str[i])) {
+			mutex_lock(&sdev->cfg_lock);
+			WRITE_ONCE(sdev->alert_mode, i);
+			mutex_unlock(&sdev->cfg_lock);
+			simtemp_trace_config(sdev);
+			return count;
+		}
+	}
+	return -EINVAL;
+}
+static DEVICE_ATTR_RW(alert_mode);
+
+/* wake_watermark (RW): records queued before blocked readers are woken */
+static ssize_t wake_watermark_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%u\n", READ_ONCE(sdev->wake_watermark));
+}
+static ssize_t wake_watermark_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	u32 watermark;
+	int ret = kstrtou32(buf, 10, &watermark);
+
+	if (ret){
+		return ret;
+	}
+	ret = simtemp_set_wakeup(sdev, watermark, READ_ONCE(sdev->wake_timeout_us));
+	if (ret){
+		return ret;
+	}
+	return count;
+}
+static DEVICE_ATTR_RW(wake_watermark);
+
+/* wake_timeout_us (RW): longest a queued record waits for a wakeup, 0 = no limit */
+static ssize_t wake_timeout_us_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%u\n", READ_ONCE(sdev->wake_timeout_us));
+}
+static ssize_t wake_timeout_us_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	u32 timeout_us;
+	int ret = kstrtou32(buf, 10, &timeout_us);
+
+	if (ret){
+		return ret;
+	}
+	ret = simtemp_set_wakeup(sdev, READ_ONCE(sdev->wake_watermark), timeout_us);
+	if (ret){
+		return ret;
+	}
+	return count;
+}
+static DEVICE_ATTR_RW(wake_timeout_us);
+
+/* stats (RO) */
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	u64 updates, alerts, dropped, defer_drops;
+	int err, cpu;
+
+	updates = atomic64_read(&sdev->update_count);
+	alerts = atomic64_read(&sdev->alert_count);
+	err = READ_ONCE(sdev->last_error);
+	dropped = 0;
+	for_each_possible_cpu(cpu){
+		dropped += *per_cpu_ptr(sdev->dropped, cpu);
+	}
+	defer_drops = READ_ONCE(sdev->defer_drops);
+
+	return sysfs_emit(buf, "updates=%llu alerts=%llu last_error=%d dropped=%llu defer_drops=%llu\n",
+			  updates, alerts, err, dropped, defer_drops);
+}
+static DEVICE_ATTR_RO(stats);
+
+/* mode (RW) */
+static const char *const simtemp_mode_str[] = { "normal", "noisy", "ramp", "sine", "square", "profile", "replay" };
+static ssize_t mode_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%s\n", simtemp_mode_str[sdev->mode]);
+}
+static ssize_t mode_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	int i;
+	int ret;
+
+	for (i = 0; i < MODE_MAX; i++) {
+		if (sysfs_streq(buf, simtemp_mode_str[i])) {
+			ret = simtemp_set_mode(sdev, i);
+			return ret ? ret : count;
+		}
+	}
+	return -EINVAL;
+}
+static DEVICE_ATTR_RW(mode);
+
+/* seed (RW): seed of the jitter PRNG; writing restarts the stream, 0 picks a random seed */
+static ssize_t seed_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%llu\n", READ_ONCE(sdev->seed));
+}
+static ssize_t seed_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	u64 seed;
+	int ret = kstrtou64(buf, 0, &seed);
+
+	if (ret){
+		return ret;
+	}
+	simtemp_set_seed(sdev, seed);
+	return count;
+}
+static DEVICE_ATTR_RW(seed);
+
+/* wave_len (RW): samples per sine/square cycle */
+static ssize_t wave_len_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%u\n", READ_ONCE(sdev->wave_len));
+}
+static ssize_t wave_len_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	u32 len;
+	int ret = kstrtou32(buf, 10, &len);
+
+	if (ret){
+		return ret;
+	}
+	ret = simtemp_set_wave(sdev, len, READ_ONCE(sdev->wave_amplitude_mC));
+	if (ret){
+		return ret;
+	}
+	return count;
+}
+static DEVICE_ATTR_RW(wave_len);
+
+/* wave_amplitude_mC (RW): peak deviation of the sine/square wave from 42 °C */
+static ssize_t wave_amplitude_mC_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%d\n", READ_ONCE(sdev->wave_amplitude_mC));
+}
+static ssize_t wave_amplitude_mC_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	s32 amplitude;
+	int ret = kstrtos32(buf, 10, &amplitude);
+
+	if (ret){
+		return ret;
+	}
+	ret = simtemp_set_wave(sdev, READ_ONCE(sdev->wave_len), amplitude);
+	if (ret){
+		return ret;
+	}
+	return count;
+}
+static DEVICE_ATTR_RW(wave_amplitude_mC);
+
+/* replay_status (RO): progress of a trace playback */
+static ssize_t replay_status_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	u32 pos = 0, len = 0;
+	bool loop = false, done;
+
+	mutex_lock(&sdev->cfg_lock);
+	if (sdev->wave && sdev->wave->mode == MODE_REPLAY) {
+		pos = READ_ONCE(sdev->wave_pos);
+		len = sdev->wave->len;
+		loop = sdev->wave->loop;
+	}
+	done = READ_ONCE(sdev->wave_done);
+	mutex_unlock(&sdev->cfg_lock);
+
+	return sysfs_emit(buf, "position=%u length=%u loop=%d done=%d\n", done ? len : pos, len, loop, done);
+}
+static DEVICE_ATTR_RO(replay_status);
+
+/* current_timestamp_clock (RW): clock used for timestamp_ns */
+static const char *const simtemp_ts_clock_str[] = { "realtime", "monotonic", "monotonic_raw", "boottime" };
+static ssize_t current_timestamp_clock_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%s\n", simtemp_ts_clock_str[READ_ONCE(sdev->ts_clock)]);
+}
+static ssize_t current_timestamp_clock_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	int i;
+
+	for (i = 0; i < TS_CLOCK_MAX; i++) {
+		if (sysfs_streq(buf, simtemp_ts_clock_str[i])) {
+			/* Takes effect on the next tick; records already queued keep their clock */
+			mutex_lock(&sdev->cfg_lock);
+			WRITE_ONCE(sdev->ts_clock, i);
+			mutex_unlock(&sdev->cfg_lock);
+			simtemp_trace_config(sdev);
+			return count;
+		}
+	}
+	return -EINVAL;
+}
+static DEVICE_ATTR_RW(current_timestamp_clock);
+
+/* aggregate (RW): raw samples folded into each record, 1 disables aggregation */
+static ssize_t aggregate_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%u\n", sdev->aggregate);
+}
+static ssize_t aggregate_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	u32 factor;
+	int ret = kstrtou32(buf, 10, &factor);
+
+	if (ret){
+		return ret;
+	}
+	ret = simtemp_set_aggregate(sdev, factor);
+	if (ret){
+		return ret;
+	}
+	return count;
+}
+static DEVICE_ATTR_RW(aggregate);
+
+/* producer (RW): context in which samples are generated */
+static const char *const simtemp_producer_str[] = { "hardirq", "softirq", "thread" };
+static ssize_t producer_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%s\n", simtemp_producer_str[sdev->producer]);
+}
+static ssize_t producer_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	int i;
+	int ret;
+
+	for (i = 0; i < PRODUCER_MAX; i++) {
+		if (sysfs_streq(buf, simtemp_producer_str[i])) {
+			ret = simtemp_set_producer(sdev, i);
+			return ret ? ret : count;
+		}
+	}
+	return -EINVAL;
+}
+static DEVICE_ATTR_RW(producer);
+
+/* fifo_depth (RW): history ring depth in records */
+static ssize_t fifo_depth_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%u\n", READ_ONCE(sdev->fifo_depth));
+}
+static ssize_t fifo_depth_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	u32 depth;
+	int ret = kstrtou32(buf, 10, &depth);
+
+	if (ret){
+		return ret;
+	}
+	ret = simtemp_set_fifo_depth(sdev, depth);
+	if (ret){
+		return ret;
+	}
+	return count;
+}
+static DEVICE_ATTR_RW(fifo_depth);
+
+/* timer (RW): "own" hrtimer per instance or the "shared" coalesced one */
+static ssize_t timer_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%s\n", READ_ONCE(sdev->shared_timer) ? "shared" : "own");
+}
+static ssize_t timer_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	bool shared;
+
+	if (sysfs_streq(buf, "shared")){
+		shared = true;
+	} else if (sysfs_streq(buf, "own")){
+		shared = false;
+	} else {
+		return -EINVAL;
+	}
+
+	mutex_lock(&sdev->cfg_lock);
+	if (shared != sdev->shared_timer) {
+		simtemp_timer_cancel(sdev);
+		WRITE_ONCE(sdev->shared_timer, shared);
+		simtemp_timer_start(sdev);
+	}
+	mutex_unlock(&sdev->cfg_lock);
+	simtemp_trace_config(sdev);
+
+	return count;
+}
+static DEVICE_ATTR_RW(timer);
+
+/* timer_phase (RW): "reset" restarts the tick schedule on reconfiguration, "continuous" keeps it */
+static ssize_t timer_phase_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%s\n", READ_ONCE(sdev->phase_continuous) ? "continuous" : "reset");
+}
+static ssize_t timer_phase_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	bool continuous;
+
+	if (sysfs_streq(buf, "continuous")){
+		continuous = true;
+	} else if (sysfs_streq(buf, "reset")){
+		continuous = false;
+	} else {
+		return -EINVAL;
+	}
+
+	/* Takes effect at the next restart, the running schedule is left alone */
+	mutex_lock(&sdev->cfg_lock);
+	WRITE_ONCE(sdev->phase_continuous, continuous);
+	mutex_unlock(&sdev->cfg_lock);
+	simtemp_trace_config(sdev);
+
+	return count;
+}
+static DEVICE_ATTR_RW(timer_phase);
+
+/* timer_slack_us (RW): how late a tick may fire, 0 for exact periods */
+static ssize_t timer_slack_us_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%u\n", READ_ONCE(sdev->timer_slack_us));
+}
+static ssize_t timer_slack_us_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	u32 slack_us;
+	int ret = kstrtou32(buf, 10, &slack_us);
+
+	if (ret){
+		return ret;
+	}
+	ret = simtemp_set_timer_slack(sdev, slack_us);
+	if (ret){
+		return ret;
+	}
+	return count;
+}
+static DEVICE_ATTR_RW(timer_slack_us);
+
+/* cpu (RW): CPU the instance is pinned to, -1 for none */
+static ssize_t cpu_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	return sysfs_emit(buf, "%d\n", READ_ONCE(sdev->cpu));
+}
+static ssize_t cpu_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+	int cpu;
+	int ret = kstrtoint(buf, 10, &cpu);
+
+	if (ret){
+		return ret;
+	}
+	ret = simtemp_set_cpu(sdev, cpu);
+	if (ret){
+		return ret;
+	}
+	return count;
+}
+static DEVICE_ATTR_RW(cpu);
+
+static struct attribute *simtemp_attrs[] = {
+	&dev_attr_sampling_ms.attr,
+	&dev_attr_sampling_us.attr,
+	&dev_attr_threshold_mC.attr,
+	&dev_attr_hysteresis_mC.attr,
+	&dev_attr_alert_mode.attr,
+	&dev_attr_wake_watermark.attr,
+	&dev_attr_wake_timeout_us.attr,
+	&dev_attr_stats.attr,
+	&dev_attr_mode.attr,
+	&dev_attr_seed.attr,
+	&dev_attr_wave_len.attr,
+	&dev_attr_wave_amplitude_mC.attr,
+	&dev_attr_replay_status.attr,
+	&dev_attr_current_timestamp_clock.attr,
+	&dev_attr_aggregate.attr,
+	&dev_attr_producer.attr,
+	&dev_attr_fifo_depth.attr,
+	&dev_attr_timer.attr,
+	&dev_attr_timer_phase.attr,
+	&dev_attr_timer_slack_us.attr,
+	&dev_attr_cpu.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(simtemp);
+
+/* --- File Operations --- */
+static int simtemp_open (struct inode *inode, struct file *file)
+{
+    /* Retrieve the miscdevice, then our private data from it */
+	struct miscdevice *miscdev = file->private_data;
+	struct simtemp_device *sdev = container_of(miscdev, struct simtemp_device, miscdev);
+	struct simtemp_file *sfile;
+	int ret;
+
+	sfile = kzalloc(sizeof(*sfile), GFP_KERNEL);
+	if (!sfile){
+		return -ENOMEM;
+	}
+	/* Restarts sampling if the device went idle, before the cursor is taken */
+	ret = pm_runtime_resume_and_get(&sdev->pdev->dev);
+	if (ret){
+		kfree(sfile);
+		return ret;
+	}
+	sfile->sdev = sdev;
+	mutex_init(&sfile->read_lock);
+	mutex_init(&sfile->upload_lock);
+	/* New readers start with the live stream, not whatever is in the history */
+	sfile->cursor = smp_load_acquire(&sdev->hist_head);
+	sfile->alert_seen = atomic64_read(&sdev->alert_count);
+	file->private_data = sfile;
+
+    return 0;
+}
+static int simtemp_release (struct inode *inode, struct file *file)
+{
+	struct simtemp_file *sfile = file->private_data;
+	struct device *dev = &sfile->sdev->pdev->dev;
+
+    pr_debug("nxp_simtemp - file released\n");
+	if (sfile->replay){
+		/* Upload that was never completed */
+		atomic_sub(sfile->replay->len, &sfile->sdev->replay_pending);
+		kvfree(sfile->replay);
+	}
+	mutex_destroy(&sfile->upload_lock);
+	mutex_destroy(&sfile->read_lock);
+	kfree(sfile);
+	pm_runtime_mark_last_busy(dev);
+	pm_runtime_put_autosuspend(dev);
+    return 0;
+}
+static ssize_t simtemp_read(struct file *file, char __user *user_buf, size_t len, loff_t *off)
+{
+	struct simtemp_file *sfile = file->private_data;
+   	struct simtemp_device *sdev = sfile->sdev;
+	int ret;
+	u64 head;
+	size_t count;
+	size_t sample_size;
+	s64 wake_lat;
+	bool waited = false;
+
+	if (mutex_lock_interruptible(&sfile->read_lock)){
+		return -ERESTARTSYS;
+	}
+
+	/* We only support reading whole records; any trailing partial slot is ignored */
+	sample_size = simtemp_record_size(sfile);
+	if (len < sample_size){
+		mutex_unlock(&sfile->read_lock);
+		return -EINVAL;
+	}
+
+	while (!simtemp_hist_pending(sdev, sfile)) {
+		mutex_unlock(&sfile->read_lock);
+		if (file->f_flags & O_NONBLOCK){
+			return -EAGAIN;
+		}
+		/* Blocking read wait condition */
+		ret = wait_event_interruptible(sdev->wq, simtemp_hist_pending(sdev, sfile));
+		if (ret){
+			return ret; /* Interrupted by a signal */
+		}
+		waited = true;
+		if (mutex_lock_interruptible(&sfile->read_lock)){
+			return -ERESTARTSYS;
+		}
+	}
+
+	/* Keeps the history ring from being resized under us */
+	down_read(&sdev->hist_rwsem);
+
+	/*
+	 * The producer never waits for readers, so a slow reader can be lapped
+	 * while copying. Copy optimistically, then re-check the head and retry
+	 * if the oldest copied samples may have been overwritten meanwhile.
+	 */
+	do {
+		head = smp_load_acquire(&sdev->hist_head);
+		if (!simtemp_hist_valid(sdev, head, sfile->cursor)) {
+			u64 lost = head - sdev->fifo_depth + 1 - sfile->cursor;
+
+			sfile->overruns += lost;
+			this_cpu_add(*sdev->dropped, lost);
+			trace_simtemp_sample_dropped(sdev->id, SIMTEMP_DROP_HISTORY, lost);
+			sfile->cursor += lost;
+		}
+		simtemp_stat_max(&sdev->fifo_hwm, head - sfile->cursor);
+
+		/* Drain as many whole samples as fit in the user buffer */
+		count = min_t(u64, head - sfile->cursor, len / sample_size);
+		ret = simtemp_hist_copy(sdev, sfile, user_buf, sfile->cursor, count);
+		if (ret){
+			break;
+		}
+
+		smp_rmb();
+	} while (!simtemp_hist_valid(sdev, READ_ONCE(sdev->hist_head), sfile->cursor));
+	if (!ret){
+		simtemp_lat_account(sdev, sfile->cursor, count);
+		trace_simtemp_sample_read(sdev->id, sfile->cursor, count, sfile->format);
+	}
+	up_read(&sdev->hist_rwsem);
+
+	if (!ret) {
+		sfile->cursor += count;
+		/* Reading acknowledges any pending alert for this reader */
+		sfile->alert_seen = atomic64_read(&sdev->alert_count);
+	}
+	mutex_unlock(&sfile->read_lock);
+
+	if (!ret && waited) {
+		wake_lat = ktime_get_ns() - READ_ONCE(sdev->last_wake_ns);
+		atomic64_add(wake_lat, &sdev->wake_lat_sum_ns);
+		atomic64_inc(&sdev->wake_lat_count);
+		simtemp_stat_max(&sdev->wake_lat_max_ns, wake_lat);
+	}
+
+	if (ret){
+		WRITE_ONCE(sdev->last_error, ret);
+		return ret;
+	}
+	return count * sample_size;
+}
+/* --- Event fd --- */
+
+static bool simtemp_event_pending(struct simtemp_device *sdev, struct simtemp_event_file *efile)
+{
+	return smp_load_acquire(&sdev->event_head) != efile->cursor;
+}
+
+static ssize_t simtemp_event_read(struct file *file, char __user *user_buf, size_t len, loff_t *off)
+{
+	struct simtemp_event_file *efile = file->private_data;
+	struct simtemp_device *sdev = efile->sdev;
+	struct simtemp_event ev;
+	size_t done = 0;
+	u64 head;
+	int ret = 0;
+
+	if (len < sizeof(ev)){
+		return -EINVAL;
+	}
+	if (mutex_lock_interruptible(&efile->read_lock)){
+		return -ERESTARTSYS;
+	}
+
+	while (!simtemp_event_pending(sdev, efile)) {
+		mutex_unlock(&efile->read_lock);
+		if (file->f_flags & O_NONBLOCK){
+			return -EAGAIN;
+		}
+		ret = wait_event_interruptible(sdev->event_wq, simtemp_event_pending(sdev, efile));
+		if (ret){
+			return ret;
+		}
+		if (mutex_lock_interruptible(&efile->read_lock)){
+			return -ERESTARTSYS;
+		}
+	}
 
-	if (ret){
-		return ret;
+	/* Events are few and small: copy them one at a time through the stack */
+	while (done + sizeof(ev) <= len) {
+		head = smp_load_acquire(&sdev->event_head);
+		if (head == efile->cursor){
+			break;
+		}
+		if (head - efile->cursor >= EVENT_SLOTS){
+			/* Lapped: skip to the oldest intact event, the gap shows in ev.seq */
+			efile->cursor = head - EVENT_SLOTS + 1;
+		}
+		ev = sdev->events[efile->cursor & (EVENT_SLOTS - 1)];
+		smp_rmb();
+		if (READ_ONCE(sdev->event_head) - efile->cursor >= EVENT_SLOTS){
+			continue; /* Overwritten while we copied it */
+		}
+		if (copy_to_user(user_buf + done, &ev, sizeof(ev))) {
+			ret = -EFAULT;
+			break;
+		}
+		efile->cursor++;
+		done += sizeof(ev);
 	}
-	spin_lock_irqsave(&sdev->lock, flags);
-	sdev->threshold_mC = new_thresh;
-	spin_unlock_irqrestore(&sdev->lock, flags);
-	pr_debug("nxp_simtemp - new_threshold: %i\n", sdev->threshold_mC);
+	mutex_unlock(&efile->read_lock);
 
-	return count;
+	if (!done && ret){
+		return ret;
+	}
+	return done;
 }
-static DEVICE_ATTR_RW(threshold_mC);
 
-/* stats (RO) */
-static ssize_t stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+static __poll_t simtemp_event_poll(struct file *file, struct poll_table_struct *wait)
 {
-	struct simtemp_device *sdev = dev_get_drvdata(dev);
-	unsigned long flags;
-	u64 updates, alerts;
-	int err;
+	struct simtemp_event_file *efile = file->private_data;
+	struct simtemp_device *sdev = efile->sdev;
 
-	spin_lock_irqsave(&sdev->lock, flags);
-	updates = sdev->update_count;
-	alerts = sdev->alert_count;
-	err = sdev->last_error;
-	spin_unlock_irqrestore(&sdev->lock, flags);
+	poll_wait(file, &sdev->event_wq, wait);
 
-	return sysfs_emit(buf, "updates=%llu alerts=%llu last_error=%d\n", updates, alerts, err);
+	return simtemp_event_pending(sdev, efile) ? EPOLLIN | EPOLLRDNORM : 0;
 }
-static DEVICE_ATTR_RO(stats);
 
-/* mode (RW) */
-static const char *const simtemp_mode_str[] = { "normal", "noisy", "ramp" };
-static ssize_t mode_show(struct device *dev, struct device_attribute *attr, char *buf)
+static int simtemp_event_release(struct inode *inode, struct file *file)
 {
-	struct simtemp_device *sdev = dev_get_drvdata(dev);
-	return sysfs_emit(buf, "%s\n", simtemp_mode_str[sdev->mode]);
+	struct simtemp_event_file *efile = file->private_data;
+
+	fput(efile->parent);
+	mutex_destroy(&efile->read_lock);
+	kfree(efile);
+	return 0;
 }
-static ssize_t mode_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+
+static const struct file_operations simtemp_event_fops = {
+	.owner = THIS_MODULE,
+	.read = simtemp_event_read,
+	.poll = simtemp_event_poll,
+	.release = simtemp_event_release,
+	.llseek = no_llseek,
+};
+
+/* Returns a new fd that only carries alert events, see struct simtemp_event */
+static int simtemp_event_fd(struct file *file, struct simtemp_device *sdev)
 {
-	struct simtemp_device *sdev = dev_get_drvdata(dev);
-	int i;
-	unsigned long flags;
+	struct simtemp_event_file *efile;
+	int fd;
 
-	for (i = 0; i < MODE_MAX; i++) {
-		if (sysfs_streq(buf, simtemp_mode_str[i])) {
-			spin_lock_irqsave(&sdev->lock, flags);
-			sdev->mode = i;
-			if (i == MODE_RAMP){
-				sdev->ramp_temp = 25000; /* Reset ramp on mode set */
-			}
-			spin_unlock_irqrestore(&sdev->lock, flags);
-			return count;
-		}
+	efile = kzalloc(sizeof(*efile), GFP_KERNEL);
+	if (!efile){
+		return -ENOMEM;
 	}
-	return -EINVAL;
+	efile->sdev = sdev;
+	efile->parent = get_file(file);
+	mutex_init(&efile->read_lock);
+	/* Like data readers, start with the events raised from now on */
+	efile->cursor = smp_load_acquire(&sdev->event_head);
+
+	fd = anon_inode_getfd("simtemp_events", &simtemp_event_fops, efile, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fput(efile->parent);
+		mutex_destroy(&efile->read_lock);
+		kfree(efile);
+	}
+	return fd;
 }
-static DEVICE_ATTR_RW(mode);
-
-static struct attribute *simtemp_attrs[] = {
-	&dev_attr_sampling_ms.attr,
-	&dev_attr_threshold_mC.attr,
-	&dev_attr_stats.attr,
-	&dev_attr_mode.attr,
-	NULL,
-};
-ATTRIBUTE_GROUPS(simtemp);
 
-/* --- File Operations --- */
-static int simtemp_open (struct inode *inode, struct file *file)
+/*
+ * Fills the trace started with SIMTEMP_IOC_REPLAY_BEGIN. Data is copied once,
+ * into the buffer the producer then plays back from directly.
+ */
+static ssize_t simtemp_write(struct file *file, const char __user *user_buf, size_t len, loff_t *off)
 {
-    /* Retrieve the miscdevice, then our private data from it */
-	struct miscdevice *miscdev = file->private_data;
-	struct simtemp_device *sdev = container_of(miscdev, struct simtemp_device, miscdev);
+	struct simtemp_file *sfile = file->private_data;
+	struct simtemp_device *sdev = sfile->sdev;
+	struct simtemp_wave *wave;
+	size_t total, n;
+
+	if (mutex_lock_interruptible(&sfile->upload_lock)){
+		return -ERESTARTSYS;
+	}
+	wave = sfile->replay;
+	if (!wave) {
+		mutex_unlock(&sfile->upload_lock);
+		return -EINVAL;
+	}
 
-	file->private_data = sdev;
+	total = (size_t)wave->len * sizeof(s32);
+	n = min(len, total - sfile->replay_off);
+	if (copy_from_user((char *)wave->temp_mC + sfile->replay_off, user_buf, n)) {
+		mutex_unlock(&sfile->upload_lock);
+		return -EFAULT;
+	}
+	sfile->replay_off += n;
+
+	if (sfile->replay_off == total) {
+		/* Complete: the device takes ownership and starts playback */
+		sfile->replay = NULL;
+		atomic_sub(wave->len, &sdev->replay_pending);
+		mutex_lock(&sdev->cfg_lock);
+		simtemp_wave_install(sdev, MODE_REPLAY, wave);
+		mutex_unlock(&sdev->cfg_lock);
+		simtemp_trace_config(sdev);
+	}
+	mutex_unlock(&sfile->upload_lock);
 
-    return 0;
+	return n;
 }
-static int simtemp_release (struct inode *inode, struct file *file)
+
+/* The extensible ioctls carry the caller's struct size, so they are matched without it */
+static unsigned int simtemp_ioctl_cmd(unsigned int cmd)
 {
-    pr_info("nxp_simtemp - file released");
-    return 0;
+	static const unsigned int ext_cmds[] = {
+		SIMTEMP_IOC_SET_CONFIG_EXT,
+		SIMTEMP_IOC_GET_CONFIG_EXT,
+		SIMTEMP_IOC_GET_SNAPSHOT,
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ext_cmds); i++) {
+		if (_IOC_TYPE(cmd) == _IOC_TYPE(ext_cmds[i]) && _IOC_NR(cmd) == _IOC_NR(ext_cmds[i]) &&
+		    _IOC_DIR(cmd) == _IOC_DIR(ext_cmds[i])){
+			return ext_cmds[i];
+		}
+	}
+	return cmd;
 }
-static ssize_t simtemp_read(struct file *file, char __user *user_buf, size_t len, loff_t *off)
+
+static long simtemp_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
-   	struct simtemp_device *sdev = file->private_data;
-    int ret;
-    struct simtemp_sample sample;
-    size_t sample_size = sizeof(struct simtemp_sample);
-   	unsigned long flags;
+	struct simtemp_file *sfile = file->private_data;
+    struct simtemp_device *sdev = sfile->sdev;
+	struct simtemp_config config;
+	struct simtemp_config_v2 config_v2;
+	struct simtemp_reader_stats rstats;
+	struct simtemp_wakeup wakeup;
+	struct simtemp_profile profile;
+	struct simtemp_replay replay;
+	struct simtemp_config_ext config_ext;
+	struct simtemp_snapshot snap;
+	u32 value, usize;
+	int ret;
 
-    /* We only support reading whole samples at a time */
-    if (len < sample_size){
-        return -EINVAL;
-    }
+	switch (simtemp_ioctl_cmd(cmd)) {
+	case SIMTEMP_IOC_SET_CONFIG:
+		if (copy_from_user(&config, (void __user *)arg, sizeof(config))){
+			return -EFAULT;
+		}
 
-	if (kfifo_is_empty(&sdev->sample_fifo)) {
-		if (file->f_flags & O_NONBLOCK){
-			return -EAGAIN;
+		if (config.sampling_ms < MIN_SAMPLING_MS || config.sampling_ms > MAX_SAMPLING_MS){
+			return -EINVAL;
 		}
-		/* Blocking read wait condition */
-		ret = wait_event_interruptible(sdev->wq, !kfifo_is_empty(&sdev->sample_fifo));
+		ret = simtemp_set_config(sdev, config.sampling_ms * USEC_PER_MSEC, &config.threshold_mC);
 		if (ret){
-			return ret; /* Interrupted by a signal */
+			return ret;
 		}
-	}
+		return 0;
 
-    printk("nxp_simtemp - Read is called");
+	case SIMTEMP_IOC_SET_CONFIG_V2:
+		if (copy_from_user(&config_v2, (void __user *)arg, sizeof(config_v2))){
+			return -EFAULT;
+		}
+		if (config_v2.version != SIMTEMP_CONFIG_VERSION || config_v2.reserved){
+			return -EINVAL;
+		}
+		ret = simtemp_set_config(sdev, config_v2.sampling_us, &config_v2.threshold_mC);
+		if (ret){
+			return ret;
+		}
+		return 0;
 
-    spin_lock_irqsave(&sdev->lock, flags);
+	case SIMTEMP_IOC_SET_CONFIG_EXT:
+		if (get_user(usize, (u32 __user *)arg)){
+			return -EFAULT;
+		}
+		if (usize < SIMTEMP_CONFIG_EXT_SIZE_VER0 || usize > PAGE_SIZE){
+			return -EINVAL;
+		}
+		/* Zero-fills what an older caller lacks, -E2BIG for unknown non-zero fields */
+		ret = copy_struct_from_user(&config_ext, sizeof(config_ext), (void __user *)arg, usize);
+		if (ret){
+			return ret;
+		}
+		return simtemp_set_config_ext(sdev, &config_ext);
 
-	ret = kfifo_get(&sdev->sample_fifo, &sample);
+	case SIMTEMP_IOC_GET_CONFIG_EXT:
+		if (get_user(usize, (u32 __user *)arg)){
+			return -EFAULT;
+		}
+		if (usize < SIMTEMP_CONFIG_EXT_SIZE_VER0 || usize > PAGE_SIZE){
+			return -EINVAL;
+		}
+		simtemp_get_config_ext(sdev, &config_ext);
+		config_ext.size = min_t(u32, usize, sizeof(config_ext));
+		if (copy_to_user((void __user *)arg, &config_ext, config_ext.size)){
+			return -EFAULT;
+		}
+		return 0;
 
-	if (!ret) { /* Should not happen due to wait_event, but better be safe */
-		spin_unlock_irqrestore(&sdev->lock, flags);
-		return -EAGAIN;
-	}
+	case SIMTEMP_IOC_GET_SNAPSHOT:
+		if (get_user(usize, (u32 __user *)arg)){
+			return -EFAULT;
+		}
+		if (usize < SIMTEMP_SNAPSHOT_SIZE_VER0 || usize > PAGE_SIZE){
+			return -EINVAL;
+		}
+		simtemp_get_snapshot(sfile, &snap);
+		snap.size = min_t(u32, usize, sizeof(snap));
+		if (copy_to_user((void __user *)arg, &snap, snap.size)){
+			return -EFAULT;
+		}
+		return 0;
 
-    /* Clear event flags on read */
-	sdev->event_flags = 0;
-	spin_unlock_irqrestore(&sdev->lock, flags);
-	if (copy_to_user(user_buf, &sample, sizeof(sample))) {
-    	spin_lock_irqsave(&sdev->lock, flags);
-        sdev->last_error = -EFAULT;
-        spin_unlock_irqrestore(&sdev->lock, flags);
-	    return -EFAULT;
-	}
-	return sizeof(sample);
-}
-static long simtemp_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
-{
-    pr_debug("nxp_simtemp - Received ioctl command: %#x\n", cmd);
-    pr_debug("nxp_simtemp - Expected ioctl command: %#lx\n", (long unsigned int)SIMTEMP_IOC_SET_CONFIG);
-    struct simtemp_device *sdev = file->private_data;
-	struct simtemp_config config;
-	unsigned long flags;
+	case SIMTEMP_IOC_SET_AGGREGATE:
+		if (get_user(value, (u32 __user *)arg)){
+			return -EFAULT;
+		}
+		return simtemp_set_aggregate(sdev, value);
 
-	if (cmd == SIMTEMP_IOC_SET_CONFIG) {
-		if (copy_from_user(&config, (void __user *)arg, sizeof(config))){
+	case SIMTEMP_IOC_SET_FIFO_DEPTH:
+		if (get_user(value, (u32 __user *)arg)){
 			return -EFAULT;
 		}
+		return simtemp_set_fifo_depth(sdev, value);
 
-		if (config.sampling_ms < MIN_SAMPLING_MS || config.sampling_ms > MAX_SAMPLING_MS){
+	case SIMTEMP_IOC_SET_RECORD_FORMAT:
+		if (get_user(value, (u32 __user *)arg)){
+			return -EFAULT;
+		}
+		if (value != SIMTEMP_RECORD_SAMPLE && value != SIMTEMP_RECORD_SUMMARY){
 			return -EINVAL;
 		}
+		mutex_lock(&sfile->read_lock);
+		sfile->format = value;
+		mutex_unlock(&sfile->read_lock);
+		return 0;
 
-		spin_lock_irqsave(&sdev->lock, flags);
-		sdev->sampling_ms = config.sampling_ms;
-		sdev->threshold_mC = config.threshold_mC;
-		spin_unlock_irqrestore(&sdev->lock, flags);
+	case SIMTEMP_IOC_SET_WAKEUP:
+		if (copy_from_user(&wakeup, (void __user *)arg, sizeof(wakeup))){
+			return -EFAULT;
+		}
+		return simtemp_set_wakeup(sdev, wakeup.watermark, wakeup.timeout_us);
+
+	case SIMTEMP_IOC_SET_PROFILE:
+		if (copy_from_user(&profile, (void __user *)arg, sizeof(profile))){
+			return -EFAULT;
+		}
+		return simtemp_set_profile(sdev, &profile);
+
+	case SIMTEMP_IOC_REPLAY_BEGIN:
+		/* The trace is filled with write() */
+		if (!(file->f_mode & FMODE_WRITE)){
+			return -EBADF;
+		}
+		if (copy_from_user(&replay, (void __user *)arg, sizeof(replay))){
+			return -EFAULT;
+		}
+		return simtemp_replay_begin(sfile, &replay);
+
+	case SIMTEMP_IOC_GET_EVENT_FD:
+		return simtemp_event_fd(file, sdev);
 
-		 pr_info("nxp_simtemp - Config changed, sampling: %u, threshold: %i\n", sdev->sampling_ms, sdev->threshold_mC);
+	case SIMTEMP_IOC_GET_READER_STATS:
+		mutex_lock(&sfile->read_lock);
+		rstats.cursor = sfile->cursor;
+		rstats.overruns = sfile->overruns;
+		rstats.pending = min_t(u64, smp_load_acquire(&sdev->hist_head) - sfile->cursor, READ_ONCE(sdev->fifo_depth) - 1);
+		mutex_unlock(&sfile->read_lock);
 
-		/* Restart timer with new period */
-		hrtimer_start(&sdev->timer, ms_to_ktime(sdev->sampling_ms), HRTIMER_MODE_REL);
+		if (copy_to_user((void __user *)arg, &rstats, sizeof(rstats))){
+			return -EFAULT;
+		}
 		return 0;
 	}
 
@@ -338,36 +3160,176 @@ static long simtemp_ioctl(struct file *file, unsigned int cmd, unsigned long arg
 }
 static __poll_t simtemp_poll(struct file *file, struct poll_table_struct *wait)
 {
-	struct simtemp_device *sdev = file->private_data;
+	struct simtemp_file *sfile = file->private_data;
+	struct simtemp_device *sdev = sfile->sdev;
 	__poll_t mask = 0;
-	unsigned long flags;
 
 	poll_wait(file, &sdev->wq, wait);
 
-	spin_lock_irqsave(&sdev->lock, flags);
-	if (!kfifo_is_empty(&sdev->sample_fifo)){
+	if (atomic_read(&sfile->ring_maps)) {
+		if (simtemp_ring_count(sdev)){
+			mask |= EPOLLIN | EPOLLRDNORM; /* Slots pending in the shared ring */
+		}
+	} else if (simtemp_hist_pending(sdev, sfile)){
 		mask |= EPOLLIN | EPOLLRDNORM; /* Data available to read */
 	}
 
-	if (sdev->event_flags & SIMTEMP_FLAG_THRESHOLD_CROSSED){
-		mask |= EPOLLPRI; /* High-priority event (alert) */
+	if (atomic64_read(&sdev->alert_count) != READ_ONCE(sfile->alert_seen)){
+		mask |= EPOLLPRI; /* High-priority event (alert) not yet read by this file */
 	}
-	spin_unlock_irqrestore(&sdev->lock, flags);
 
 	return mask;
 }
 
+static int simtemp_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct simtemp_file *sfile = file->private_data;
+	struct simtemp_device *sdev = sfile->sdev;
+	int ret;
+
+	/* Only the whole ring, starting at the header page, can be mapped */
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > sdev->ring_bytes){
+		return -EINVAL;
+	}
+
+	ret = remap_vmalloc_range(vma, sdev->ring_hdr, 0);
+	if (ret){
+		return ret;
+	}
+
+	/* The VMA holds a reference on the file, so @sfile outlives it */
+	vma->vm_private_data = sfile;
+	vma->vm_ops = &simtemp_vm_ops;
+	simtemp_vm_open(vma);
+
+	return 0;
+}
+
 static struct file_operations simtemp_fops = {
     .owner = THIS_MODULE,
     .open = simtemp_open,
     .release = simtemp_release,
     .read = simtemp_read,
+    .write = simtemp_write,
     .poll = simtemp_poll,
     .unlocked_ioctl = simtemp_ioctl,
+    .mmap = simtemp_mmap,
     .llseek = no_llseek
 };
 
 
+/* --- Debugfs --- */
+
+/* /sys/kernel/debug/nxp_simtemp/, shared by all instances */
+static struct dentry *simtemp_debugfs_root;
+static unsigned int simtemp_debugfs_users;
+static DEFINE_MUTEX(simtemp_debugfs_lock);
+
+static u64 simtemp_avg(u64 sum, u64 count)
+{
+	return count ? div64_u64(sum, count) : 0;
+}
+
+static int simtemp_metrics_show(struct seq_file *m, void *unused)
+{
+	struct simtemp_device *sdev = m->private;
+	u64 dropped = 0, ticks, wakeups;
+	int cpu;
+
+	for_each_possible_cpu(cpu){
+		dropped += *per_cpu_ptr(sdev->dropped, cpu);
+	}
+	ticks = READ_ONCE(sdev->timer_ticks);
+	wakeups = atomic64_read(&sdev->wake_lat_count);
+
+	seq_printf(m, "updates: %lld\n", atomic64_read(&sdev->update_count));
+	seq_printf(m, "alerts: %lld\n", atomic64_read(&sdev->alert_count));
+	seq_printf(m, "last_error: %d\n", READ_ONCE(sdev->last_error));
+	seq_printf(m, "dropped: %llu\n", dropped);
+	seq_printf(m, "defer_drops: %llu\n", READ_ONCE(sdev->defer_drops));
+	seq_printf(m, "timer_ticks: %llu\n", ticks);
+	seq_printf(m, "timer_overruns: %llu\n", READ_ONCE(sdev->timer_overruns));
+	seq_printf(m, "timer_late_max_ns: %llu\n", READ_ONCE(sdev->late_max_ns));
+	seq_printf(m, "timer_late_avg_ns: %llu\n", simtemp_avg(READ_ONCE(sdev->late_sum_ns), ticks));
+	seq_printf(m, "timer_reconfig_missed: %llu\n", READ_ONCE(sdev->reconfig_missed));
+	seq_printf(m, "produce_time_ns: %llu\n", READ_ONCE(sdev->produce_ns));
+	seq_printf(m, "fifo_depth: %u\n", READ_ONCE(sdev->fifo_depth));
+	seq_printf(m, "fifo_hwm: %lld\n", atomic64_read(&sdev->fifo_hwm));
+	seq_printf(m, "wake_latency_count: %llu\n", wakeups);
+	seq_printf(m, "wake_latency_max_ns: %lld\n", atomic64_read(&sdev->wake_lat_max_ns));
+	seq_printf(m, "wake_latency_avg_ns: %llu\n", simtemp_avg(atomic64_read(&sdev->wake_lat_sum_ns), wakeups));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(simtemp_metrics);
+
+static int simtemp_latency_show(struct seq_file *m, void *unused)
+{
+	struct simtemp_device *sdev = m->private;
+	u64 count;
+	int cpu, i;
+
+	seq_puts(m, "# enqueue-to-read latency, ns: [lower, upper) count\n");
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		count = 0;
+		for_each_possible_cpu(cpu){
+			count += READ_ONCE(per_cpu_ptr(sdev->lat_hist, cpu)->bucket[i]);
+		}
+		if (count){
+			seq_printf(m, "%llu %llu %llu\n", i ? 1ULL << (i - 1) : 0, i < LAT_BUCKETS - 1 ? 1ULL << i : U64_MAX, count);
+		}
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(simtemp_latency);
+
+/* Writing anything to latency_reset clears the histogram */
+static ssize_t simtemp_latency_reset_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct simtemp_device *sdev = file->private_data;
+	int cpu;
+
+	for_each_possible_cpu(cpu){
+		memset(per_cpu_ptr(sdev->lat_hist, cpu), 0, sizeof(struct simtemp_lat_hist));
+	}
+	return count;
+}
+
+static const struct file_operations simtemp_latency_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = simtemp_latency_reset_write,
+	.llseek = no_llseek,
+};
+
+static void simtemp_debugfs_init(struct simtemp_device *sdev)
+{
+	mutex_lock(&simtemp_debugfs_lock);
+	if (!simtemp_debugfs_users++){
+		simtemp_debugfs_root = debugfs_create_dir(DRIVER_NAME, NULL);
+	}
+	mutex_unlock(&simtemp_debugfs_lock);
+
+	/* debugfs failures are not fatal, the calls below cope with error pointers */
+	sdev->debugfs = debugfs_create_dir(sdev->miscdev.name, simtemp_debugfs_root);
+	debugfs_create_file("metrics", 0444, sdev->debugfs, sdev, &simtemp_metrics_fops);
+	debugfs_create_file("latency_hist", 0444, sdev->debugfs, sdev, &simtemp_latency_fops);
+	debugfs_create_file("latency_reset", 0200, sdev->debugfs, sdev, &simtemp_latency_reset_fops);
+}
+
+static void simtemp_debugfs_exit(struct simtemp_device *sdev)
+{
+	debugfs_remove_recursive(sdev->debugfs);
+
+	mutex_lock(&simtemp_debugfs_lock);
+	if (!--simtemp_debugfs_users) {
+		debugfs_remove_recursive(simtemp_debugfs_root);
+		simtemp_debugfs_root = NULL;
+	}
+	mutex_unlock(&simtemp_debugfs_lock);
+}
+
 /* --- Platform Driver --- */
 
 static const struct of_device_id simtemp_of_match[] = {
@@ -376,13 +3338,49 @@ static const struct of_device_id simtemp_of_match[] = {
 };
 MODULE_DEVICE_TABLE(of, simtemp_of_match);
 
+/* --- Runtime PM --- */
+
+/*
+ * Runs once the last file is closed and the autosuspend delay has passed:
+ * no timer means no wakeups for an idle device. The history is kept.
+ */
+static int __maybe_unused simtemp_runtime_suspend(struct device *dev)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+
+	mutex_lock(&sdev->cfg_lock);
+	simtemp_timer_cancel(sdev);
+	sdev->idle = true;
+	/* A phase-continuous restart would count the whole idle time as missed */
+	sdev->last_expiry_ns = 0;
+	mutex_unlock(&sdev->cfg_lock);
+
+	return 0;
+}
+
+static int __maybe_unused simtemp_runtime_resume(struct device *dev)
+{
+	struct simtemp_device *sdev = dev_get_drvdata(dev);
+
+	mutex_lock(&sdev->cfg_lock);
+	sdev->idle = false;
+	/* Tick right away, so the first reader does not wait a whole period */
+	simtemp_timer_start_at(sdev, ktime_get_ns());
+	mutex_unlock(&sdev->cfg_lock);
+
+	return 0;
+}
+
 static int simtemp_probe(struct platform_device *pdev)
 {
 	struct device *dev = &pdev->dev;
 	struct simtemp_device *sdev;
+	u64 seed = 0; /* Default: random */
+	u32 value;
 	int ret;
 
-	sdev = devm_kzalloc(dev, sizeof(*sdev), GFP_KERNEL);
+	/* Not devm_kzalloc(): the devres header would break the cache line alignment */
+	sdev = kzalloc(sizeof(*sdev), GFP_KERNEL);
 	if (!sdev){
 	    return -ENOMEM;
 	}
@@ -392,40 +3390,159 @@ static int simtemp_probe(struct platform_device *pdev)
 
 	/* Initialize private data */
 	spin_lock_init(&sdev->lock);
+	mutex_init(&sdev->cfg_lock);
+	init_rwsem(&sdev->hist_rwsem);
 	init_waitqueue_head(&sdev->wq);
-	INIT_KFIFO(sdev->sample_fifo);
+	init_waitqueue_head(&sdev->event_wq);
     sdev->ramp_temp = 25000;
+	sdev->wave_len = WAVE_LEN;
+	sdev->wave_amplitude_mC = WAVE_AMPLITUDE_MC;
+
+	sdev->dropped = alloc_percpu(u64);
+	sdev->lat_hist = alloc_percpu(struct simtemp_lat_hist);
+	if (!sdev->dropped || !sdev->lat_hist) {
+		ret = -ENOMEM;
+		goto err_percpu;
+	}
+
+	ret = simtemp_ring_alloc(sdev);
+	if (ret){
+		goto err_percpu;
+	}
 
 	/* Parse Device Tree properties or use defaults */
-	sdev->sampling_ms = 1000; /* Default: 1 second */
+	sdev->sampling_us = 1000 * USEC_PER_MSEC; /* Default: 1 second */
 	sdev->threshold_mC = 50000; /* Default: 50.0 °C */
+	sdev->aggregate = 1; /* Default: one record per raw sample */
+	sdev->wake_watermark = 1; /* Default: wake readers for every record */
+	sdev->fifo_depth = FIFO_DEPTH;
+	sdev->cpu = -1; /* Default: not pinned */
 	/* Only read DT if a node exists. */
     if (dev->of_node) {
-	    of_property_read_u32(dev->of_node, "sampling-ms", &sdev->sampling_ms);
+	    if (!of_property_read_u32(dev->of_node, "sampling-ms", &value)){
+		    sdev->sampling_us = value * USEC_PER_MSEC;
+	    }
+	    /* sampling-us takes precedence for sub-millisecond periods */
+	    of_property_read_u32(dev->of_node, "sampling-us", &sdev->sampling_us);
+	    of_property_read_u32(dev->of_node, "timer-slack-us", &sdev->timer_slack_us);
 	    of_property_read_s32(dev->of_node, "threshold-mC", &sdev->threshold_mC);
+	    of_property_read_s32(dev->of_node, "hysteresis-mC", &sdev->hysteresis_mC);
+	    of_property_read_u64(dev->of_node, "seed", &seed);
+	    if (of_property_read_bool(dev->of_node, "alert-edge")){
+		    sdev->alert_mode = ALERT_EDGE;
+	    }
+	    of_property_read_u32(dev->of_node, "fifo-depth", &sdev->fifo_depth);
+	    if (!of_property_read_u32(dev->of_node, "cpu", &value)){
+		    sdev->cpu = value;
+	    }
     }
+	if (sdev->cpu >= (int)nr_cpu_ids || (sdev->cpu >= 0 && !cpu_online(sdev->cpu))) {
+		dev_warn(dev, "CPU %d not available, not pinning\n", sdev->cpu);
+		sdev->cpu = -1;
+	}
+	simtemp_rng_seed(sdev, seed);
+	if (sdev->hysteresis_mC < 0 || sdev->hysteresis_mC > MAX_HYSTERESIS_MC) {
+		dev_warn(dev, "Invalid hysteresis %d mC, using 0\n", sdev->hysteresis_mC);
+		sdev->hysteresis_mC = 0;
+	}
+	if (sdev->sampling_us < MIN_SAMPLING_US || sdev->sampling_us > MAX_SAMPLING_US) {
+		dev_warn(dev, "Invalid sampling period %u us, using 1 s\n", sdev->sampling_us);
+		sdev->sampling_us = 1000 * USEC_PER_MSEC;
+	}
+	simtemp_update_period(sdev);
+	if (sdev->timer_slack_us > MAX_TIMER_SLACK_US) {
+		dev_warn(dev, "Invalid timer slack %u us, using 0\n", sdev->timer_slack_us);
+		sdev->timer_slack_us = 0;
+	}
+
+	if (simtemp_fifo_depth_check(&sdev->fifo_depth)) {
+		dev_warn(dev, "Invalid fifo-depth %u, using %u\n", sdev->fifo_depth, FIFO_DEPTH);
+		sdev->fifo_depth = FIFO_DEPTH;
+	}
+	ret = simtemp_hist_alloc(sdev, sdev->fifo_depth, &sdev->hist, &sdev->hist_sum, &sdev->hist_enq_ns);
+	if (ret){
+		goto err_ring;
+	}
+
+	sdev->id = ida_alloc_max(&simtemp_ida, MAX_INSTANCES - 1, GFP_KERNEL);
+	if (sdev->id < 0) {
+		ret = sdev->id;
+		goto err_hist;
+	}
 
 	/* Set up and register the misc character device */
 	sdev->miscdev.minor = MISC_DYNAMIC_MINOR;
-	sdev->miscdev.name = DEVICE_NAME;
+	sdev->miscdev.name = devm_kasprintf(dev, GFP_KERNEL, DEVICE_NAME "%d", sdev->id);
+	if (!sdev->miscdev.name) {
+		ret = -ENOMEM;
+		goto err_ida;
+	}
 	sdev->miscdev.fops = &simtemp_fops;
 	sdev->miscdev.groups = simtemp_groups;
+
+	/* Initialize the high-resolution timer */
+	sdev->producer = PRODUCER_HARDIRQ;
+	sdev->shared_timer = shared_timer;
+	simtemp_timer_setup(sdev);
+
+	/*
+	 * Runtime PM is set up active, with a reference held until the timer is
+	 * running. Unless idle_stop is set, runtime suspend is forbidden and the
+	 * timer runs until remove, as before; power/control switches it.
+	 */
+	pm_runtime_set_active(dev);
+	pm_runtime_set_autosuspend_delay(dev, AUTOSUSPEND_DELAY_MS);
+	pm_runtime_use_autosuspend(dev);
+	pm_runtime_get_noresume(dev);
+	pm_runtime_enable(dev);
+	if (!idle_stop){
+		pm_runtime_forbid(dev);
+	}
+
 	ret = misc_register(&sdev->miscdev);
 	if (ret) {
 		dev_err(dev, "Failed to register misc device\n");
-		return ret;
+		goto err_pm;
 	}
 
 	dev_set_drvdata(sdev->miscdev.this_device, sdev);
+	simtemp_debugfs_init(sdev);
+	/* Optional: the misc device works without it */
+	ret = simtemp_iio_init(sdev);
+	if (ret){
+		dev_warn(dev, "IIO registration failed (%d), continuing without it\n", ret);
+	}
 
-	/* Initialize and start the high-resolution timer */
-	hrtimer_init(&sdev->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	sdev->timer.function = &simtemp_timer_callback;
-	hrtimer_start(&sdev->timer, ms_to_ktime(sdev->sampling_ms), HRTIMER_MODE_REL);
+	/*
+	 * The node and attributes are live already: a sysfs store or an ioctl
+	 * may have started the timer first, so restart it rather than start it.
+	 */
+	mutex_lock(&sdev->cfg_lock);
+	simtemp_timer_retime(sdev);
+	mutex_unlock(&sdev->cfg_lock);
+	pm_runtime_mark_last_busy(dev);
+	pm_runtime_put_autosuspend(dev);
 
-	dev_info(dev, "NXP Virtual Temperature Sensor initialized\n");
+	dev_info(dev, "NXP Virtual Temperature Sensor initialized as /dev/%s\n", sdev->miscdev.name);
 
 	return 0;
+
+err_pm:
+	pm_runtime_disable(dev);
+	pm_runtime_put_noidle(dev);
+	pm_runtime_dont_use_autosuspend(dev);
+	pm_runtime_set_suspended(dev);
+err_ida:
+	ida_free(&simtemp_ida, sdev->id);
+err_hist:
+	simtemp_hist_free(sdev);
+err_ring:
+	vfree(sdev->ring_hdr);
+err_percpu:
+	free_percpu(sdev->dropped);
+	free_percpu(sdev->lat_hist);
+	kfree(sdev);
+	return ret;
 }
 
 #ifdef CONFIG_64BIT
@@ -440,56 +3557,99 @@ static void simtemp_remove(struct platform_device *pdev)
 
 	dev_info(&pdev->dev, "Unloading NXP Virtual Temperature Sensor\n");
 
-	hrtimer_cancel(&sdev->timer);
+	/* Waits for a suspend or resume in flight, none runs after this */
+	pm_runtime_disable(&pdev->dev);
+	pm_runtime_dont_use_autosuspend(&pdev->dev);
+	pm_runtime_set_suspended(&pdev->dev);
+	simtemp_timer_cancel(sdev);
+	if (sdev->producer_task){
+		kthread_stop(sdev->producer_task);
+	}
+	simtemp_iio_exit(sdev);
+	simtemp_debugfs_exit(sdev);
 	misc_deregister(&sdev->miscdev);
+	ida_free(&simtemp_ida, sdev->id);
+	simtemp_hist_free(sdev);
+	kvfree(sdev->wave);
+	vfree(sdev->ring_hdr);
+	free_percpu(sdev->dropped);
+	free_percpu(sdev->lat_hist);
+	kfree(sdev);
 #ifdef CONFIG_64BIT
     return 0; // Only return 0 when compiling for 64-bit
 #endif
 }
 
 
+static const struct dev_pm_ops simtemp_pm_ops = {
+	SET_RUNTIME_PM_OPS(simtemp_runtime_suspend, simtemp_runtime_resume, NULL)
+};
+
 static struct platform_driver simtemp_driver = {
 	.driver = {
 		.name = DRIVER_NAME,
 		.of_match_table = simtemp_of_match,
+		.pm = &simtemp_pm_ops,
 	},
 	.probe = simtemp_probe,
 	.remove = simtemp_remove,
 };
 
 #ifdef PC_BUILD
-static struct platform_device *simtemp_pdev;
+static struct platform_device *simtemp_pdevs[MAX_INSTANCES];
+
+static void simtemp_pdevs_unregister(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < instances; i++) {
+        platform_device_unregister(simtemp_pdevs[i]); // NULL-safe
+    }
+}
 
 static int __init simtemp_module_init(void)
 {
+    unsigned int i;
     int ret;
-    pr_info("nxp_simtemp: module init\n");
-
-    // Manually create a platform device. This is what the Device Tree
-    // would normally do for us at boot time.
-    simtemp_pdev = platform_device_alloc(DRIVER_NAME, -1);
-    if (!simtemp_pdev) {
-        pr_err("nxp_simtemp: Failed to allocate platform device\n");
-        return -ENOMEM;
+    pr_info("nxp_simtemp: module init, %u instance(s)\n", instances);
+
+    if (instances < 1 || instances > MAX_INSTANCES) {
+        pr_err("nxp_simtemp: instances must be between 1 and %d\n", MAX_INSTANCES);
+        return -EINVAL;
     }
 
-    ret = platform_device_add(simtemp_pdev);
-    if (ret) {
-        pr_err("nxp_simtemp: Failed to add platform device\n");
-        platform_device_put(simtemp_pdev); // Cleanup on failure
-        return ret;
+    // Manually create the platform devices. This is what the Device Tree
+    // would normally do for us at boot time, one per simtemp node.
+    for (i = 0; i < instances; i++) {
+        simtemp_pdevs[i] = platform_device_alloc(DRIVER_NAME, i);
+        if (!simtemp_pdevs[i]) {
+            pr_err("nxp_simtemp: Failed to allocate platform device %u\n", i);
+            ret = -ENOMEM;
+            goto err_pdevs;
+        }
+
+        ret = platform_device_add(simtemp_pdevs[i]);
+        if (ret) {
+            pr_err("nxp_simtemp: Failed to add platform device %u\n", i);
+            platform_device_put(simtemp_pdevs[i]); // Cleanup on failure
+            simtemp_pdevs[i] = NULL;
+            goto err_pdevs;
+        }
     }
 
     // Now, register our platform driver. The kernel will see that our new
-    // device's name matches our driver's name and will call our probe() function.
+    // devices' names match our driver's name and will call probe() for each.
     ret = platform_driver_register(&simtemp_driver);
     if (ret) {
         pr_err("nxp_simtemp: Failed to register platform driver\n");
-        platform_device_unregister(simtemp_pdev); // Cleanup on failure
-        return ret;
+        goto err_pdevs;
     }
 
     return 0;
+
+err_pdevs:
+    simtemp_pdevs_unregister();
+    return ret;
 }
 
 static void __exit simtemp_module_exit(void)
@@ -498,7 +3658,8 @@ static void __exit simtemp_module_exit(void)
 
     // Unregister in the reverse order of registration
     platform_driver_unregister(&simtemp_driver);
-    platform_device_unregister(simtemp_pdev);
+    simtemp_pdevs_unregister();
+    ida_destroy(&simtemp_ida);
 }
 
 module_init(simtemp_module_init);
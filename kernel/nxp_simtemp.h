@@ -14,6 +14,72 @@ struct simtemp_sample {
 
 /* Flags for the simtemp_sample.flags field */
 #define SIMTEMP_FLAG_NEW_SAMPLE        (1 << 0) /* Always set for a new sample */
-#define SIMTEMP_FLAG_THRESHOLD_CROSSED (1 << 1) /* Set if temp crossed the threshold */
+#define SIMTEMP_FLAG_THRESHOLD_CROSSED (1 << 1) /* Set while the alarm is active (temp reached the threshold) */
+#define SIMTEMP_FLAG_SUMMARY           (1 << 2) /* Record aggregates several raw samples */
+#define SIMTEMP_FLAG_THRESHOLD_RISING  (1 << 3) /* The alarm was raised by this sample */
+#define SIMTEMP_FLAG_THRESHOLD_FALLING (1 << 4) /* The alarm cleared (temp below threshold - hysteresis) */
+
+/*
+ * Alert event returned by read() on the fd from SIMTEMP_IOC_GET_EVENT_FD.
+ *
+ * One is queued for every sample that counts as an alert (see the alert_mode
+ * attribute), separately from the data stream, so an alert consumer never has
+ * to read samples. The driver keeps the last 64 events; a reader that falls
+ * further behind sees a gap in @seq.
+ */
+struct simtemp_event {
+	__u64 timestamp_ns; /* Timestamp of the triggering sample */
+	__u64 seq;          /* Event sequence number */
+	__s32 temp_mC;
+	__s32 threshold_mC; /* Threshold in force when the event was raised */
+	__u32 flags;        /* SIMTEMP_FLAG_THRESHOLD_* of the sample */
+	__u32 reserved;
+} __attribute__((packed));
+
+/*
+ * Summary record produced in aggregation mode (one per N raw samples).
+ *
+ * It starts with a regular struct simtemp_sample, so readers that did not
+ * opt in to summaries keep receiving plain samples: timestamp of the last raw
+ * sample, mean temperature, and SIMTEMP_FLAG_SUMMARY set in flags. Readers
+ * that select SIMTEMP_RECORD_SUMMARY get the full record; @version lets the
+ * layout grow later.
+ */
+#define SIMTEMP_SUMMARY_VERSION 1
+
+struct simtemp_summary {
+	struct simtemp_sample sample; /* Last timestamp, mean temp_mC, OR of raw flags */
+	__u64 first_timestamp_ns;     /* Timestamp of the first raw sample in the window */
+	__s32 min_mC;
+	__s32 max_mC;
+	__u32 count;                  /* Raw samples in this record */
+	__u32 version;
+} __attribute__((packed));
+
+/*
+ * Shared sample ring exported through mmap() on /dev/simtemp<N>.
+ *
+ * The mapping starts with one header page followed by @nr_slots entries of
+ * struct simtemp_sample at @data_offset. The kernel is the only producer and
+ * advances @head after a slot is written; the consumer advances @tail after it
+ * is done with a slot. Both are free-running counters: the slot for index i
+ * is (i & (nr_slots - 1)). When the ring is full new samples are dropped and
+ * @dropped is incremented. poll() reports EPOLLIN while head != tail.
+ */
+#define SIMTEMP_RING_VERSION 1
+
+struct simtemp_ring_header {
+	__u32 version;
+	__u32 nr_slots;     /* Always a power of two */
+	__u32 slot_size;    /* sizeof(struct simtemp_sample) */
+	__u32 data_offset;  /* Byte offset of slot 0 from the start of the mapping */
+	__u64 dropped;      /* Samples lost because the ring was full */
+	__u64 __pad0[5];
+
+	/* Producer and consumer indices live on separate cache lines */
+	__u64 head;         /* Written by the kernel only */
+	__u64 __pad1[7];
+	__u64 tail;         /* Written by the consumer only */
+};
 
 #endif /* NXP_SIMTEMP_H */
\ No newline at end of file
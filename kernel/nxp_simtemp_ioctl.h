@@ -17,6 +17,204 @@ struct simtemp_config {
 	__s32 threshold_mC;
 };
 
+/**
+ * struct simtemp_config_v2 - Microsecond-resolution configuration.
+ * @version:      Must be SIMTEMP_CONFIG_VERSION.
+ * @sampling_us:  The new sampling period in microseconds (50 us .. 60 s).
+ * @threshold_mC: The new alert threshold in milli-degrees Celsius.
+ * @reserved:     Must be zero.
+ */
+#define SIMTEMP_CONFIG_VERSION 2
+struct simtemp_config_v2 {
+	__u32 version;
+	__u32 sampling_us;
+	__s32 threshold_mC;
+	__u32 reserved;
+};
+
+/**
+ * struct simtemp_reader_stats - Per-open-file reader state.
+ * @cursor:   Sequence number of the next sample this file will return.
+ * @overruns: Samples overwritten in the history ring before this file read them.
+ * @pending:  Samples currently available to this file.
+ *
+ * Every open file has its own cursor into the shared sample history, so each
+ * reader sees the full stream and overruns are accounted per reader.
+ */
+struct simtemp_reader_stats {
+	__u64 cursor;
+	__u64 overruns;
+	__u64 pending;
+};
+
+/**
+ * struct simtemp_wakeup - Reader wakeup coalescing.
+ * @watermark:  Records queued before blocked readers and poll() are woken (1..65536).
+ * @timeout_us: Wake anyway once the oldest queued record is this old, 0 = no limit.
+ *
+ * Alerts always wake readers immediately.
+ */
+struct simtemp_wakeup {
+	__u32 watermark;
+	__u32 timeout_us;
+};
+
+/**
+ * struct simtemp_profile - Temperature profile replayed by the "profile" mode.
+ * @count:    Entries at @temps_mC, 1..65536.
+ * @reserved: Must be zero.
+ * @temps_mC: User pointer to @count __s32 temperatures in milli-degrees Celsius.
+ *
+ * The driver replays one entry per raw sample and wraps around at the end.
+ */
+struct simtemp_profile {
+	__u32 count;
+	__u32 reserved;
+	__u64 temps_mC;
+};
+
+/**
+ * struct simtemp_replay - Starts uploading a recorded trace for playback.
+ * @count:    Temperatures in the trace, 1..1M.
+ * @flags:    SIMTEMP_REPLAY_LOOP to wrap around, otherwise production stops at the end.
+ * @reserved: Must be zero.
+ *
+ * After this ioctl, write() on the same file takes @count __s32 temperatures
+ * in milli-degrees Celsius, in as many calls as needed. The write that
+ * completes the trace switches the device to the "replay" mode, which emits
+ * one entry per raw sample at the configured sampling period. The file must
+ * be open for writing (-EBADF), and unfinished uploads on all files of the
+ * device may hold at most 4M temperatures together (-EBUSY).
+ */
+#define SIMTEMP_REPLAY_LOOP (1 << 0)
+struct simtemp_replay {
+	__u64 count;
+	__u32 flags;
+	__u32 reserved;
+};
+
+/* Simulation modes, as named by the "mode" attribute */
+#define SIMTEMP_MODE_NORMAL  0
+#define SIMTEMP_MODE_NOISY   1
+#define SIMTEMP_MODE_RAMP    2
+#define SIMTEMP_MODE_SINE    3
+#define SIMTEMP_MODE_SQUARE  4
+#define SIMTEMP_MODE_PROFILE 5 /* Needs a prior SIMTEMP_IOC_SET_PROFILE */
+#define SIMTEMP_MODE_REPLAY  6 /* Needs a completed SIMTEMP_IOC_REPLAY_BEGIN upload */
+
+/* Alert modes, as named by the "alert_mode" attribute */
+#define SIMTEMP_ALERT_LEVEL 0
+#define SIMTEMP_ALERT_EDGE  1
+
+/**
+ * struct simtemp_config_ext - Whole device configuration, set and read back in one call.
+ * @size:            sizeof(struct simtemp_config_ext) as known to the caller.
+ * @flags:           Must be zero.
+ * @sampling_us:     Sampling period in microseconds (50 us .. 60 s).
+ * @threshold_mC:    Alert threshold in milli-degrees Celsius.
+ * @hysteresis_mC:   How far below the threshold the alarm clears (0..100000).
+ * @mode:            One of SIMTEMP_MODE_*.
+ * @fifo_depth:      History ring depth in records (16..65536, rounded up to a power of two).
+ * @wake_watermark:  Records queued before readers are woken (1..65536).
+ * @wake_timeout_us: Wake anyway once the oldest queued record is this old, 0 = no limit.
+ * @aggregate:       Raw samples per record, 1 disables aggregation.
+ * @alert_mode:      One of SIMTEMP_ALERT_*.
+ * @reserved:        Must be zero.
+ *
+ * SIMTEMP_IOC_SET_CONFIG_EXT validates everything before changing anything
+ * and then applies all fields with one timer restart; parts whose value did
+ * not change (mode, fifo_depth) are left running, so reading the config with
+ * SIMTEMP_IOC_GET_CONFIG_EXT, editing it and writing it back is cheap.
+ *
+ * The struct only grows at the end and @size is its version, as with
+ * sched_setattr(): the driver zero-fills fields a smaller caller does not
+ * know about, rejects non-zero bytes it does not know about with -E2BIG, and
+ * a field added later treats 0 as "keep the current value". GET writes back
+ * min(@size, its own size) bytes and sets @size to that.
+ */
+#define SIMTEMP_CONFIG_EXT_SIZE_VER0 48
+struct simtemp_config_ext {
+	__u32 size;
+	__u32 flags;
+	__u32 sampling_us;
+	__s32 threshold_mC;
+	__s32 hysteresis_mC;
+	__u32 mode;
+	__u32 fifo_depth;
+	__u32 wake_watermark;
+	__u32 wake_timeout_us;
+	__u32 aggregate;
+	__u32 alert_mode;
+	__u32 reserved;
+};
+
+/**
+ * struct simtemp_snapshot - Counters, configuration and FIFO state in one read.
+ * @size:            sizeof(struct simtemp_snapshot) as known to the caller.
+ * @flags:           Must be zero.
+ * @timestamp_ns:    CLOCK_MONOTONIC time the snapshot was taken.
+ * @sampling_us:     Sampling period in microseconds.
+ * @threshold_mC:    Alert threshold in milli-degrees Celsius.
+ * @hysteresis_mC:   How far below the threshold the alarm clears.
+ * @mode:            One of SIMTEMP_MODE_*.
+ * @fifo_depth:      History ring depth in records.
+ * @wake_watermark:  Records queued before readers are woken.
+ * @wake_timeout_us: Wakeup timeout, 0 = no limit.
+ * @aggregate:       Raw samples per record.
+ * @alert_mode:      One of SIMTEMP_ALERT_*.
+ * @cpu:             CPU the instance is pinned to, -1 if none.
+ * @updates:         Raw samples generated.
+ * @alerts:          Samples that counted as an alert.
+ * @dropped:         Samples lost by readers (history overruns) or the mmap() ring.
+ * @defer_drops:     Ticks lost because the producer thread fell behind.
+ * @timer_ticks:     Timer callbacks run for this device.
+ * @timer_overruns:  Expiries skipped because a callback ran too late.
+ * @hist_head:       Records published to the history so far.
+ * @fifo_hwm:        Largest backlog any reader found in the history.
+ * @pending:         Records queued for the calling file.
+ * @overruns:        Records the calling file lost to overwrites.
+ * @last_error:      Last internal error code, 0 if none.
+ * @alert_active:    1 while the device is in the alarm state.
+ *
+ * Filled by SIMTEMP_IOC_GET_SNAPSHOT under a single acquisition of the
+ * configuration lock, so the configuration is self-consistent and the
+ * counters were read together. Sized and versioned like struct
+ * simtemp_config_ext; the configuration is copied field by field rather than
+ * embedded so the two structs can grow independently.
+ */
+#define SIMTEMP_SNAPSHOT_SIZE_VER0 144
+struct simtemp_snapshot {
+	__u32 size;
+	__u32 flags;
+	__u64 timestamp_ns;
+	__u32 sampling_us;
+	__s32 threshold_mC;
+	__s32 hysteresis_mC;
+	__u32 mode;
+	__u32 fifo_depth;
+	__u32 wake_watermark;
+	__u32 wake_timeout_us;
+	__u32 aggregate;
+	__u32 alert_mode;
+	__s32 cpu;
+	__u64 updates;
+	__u64 alerts;
+	__u64 dropped;
+	__u64 defer_drops;
+	__u64 timer_ticks;
+	__u64 timer_overruns;
+	__u64 hist_head;
+	__u64 fifo_hwm;
+	__u64 pending;
+	__u64 overruns;
+	__s32 last_error;
+	__u32 alert_active;
+};
+
+/* Record formats returned by read(), see SIMTEMP_IOC_SET_RECORD_FORMAT */
+#define SIMTEMP_RECORD_SAMPLE  0 /* struct simtemp_sample (default) */
+#define SIMTEMP_RECORD_SUMMARY 1 /* struct simtemp_summary */
+
 /*
  * IOCTL Commands
  * _IOW: An ioctl that writes data from user space to the kernel.
@@ -25,5 +223,24 @@ struct simtemp_config {
  * - Argument type: struct simtemp_config
  */
 #define SIMTEMP_IOC_SET_CONFIG _IOW(SIMTEMP_IOCTL_MAGIC, 1, struct simtemp_config)
+#define SIMTEMP_IOC_GET_READER_STATS _IOR(SIMTEMP_IOCTL_MAGIC, 2, struct simtemp_reader_stats)
+/* Aggregation factor N: one record per N raw samples, 1 disables aggregation */
+#define SIMTEMP_IOC_SET_AGGREGATE _IOW(SIMTEMP_IOCTL_MAGIC, 3, __u32)
+/* History ring depth in records (16..65536, rounded up to a power of two) */
+#define SIMTEMP_IOC_SET_FIFO_DEPTH _IOW(SIMTEMP_IOCTL_MAGIC, 5, __u32)
+/* Per-file record format, one of SIMTEMP_RECORD_* */
+#define SIMTEMP_IOC_SET_RECORD_FORMAT _IOW(SIMTEMP_IOCTL_MAGIC, 4, __u32)
+#define SIMTEMP_IOC_SET_CONFIG_V2 _IOW(SIMTEMP_IOCTL_MAGIC, 6, struct simtemp_config_v2)
+/* Returns a new read-only fd carrying only struct simtemp_event records */
+#define SIMTEMP_IOC_GET_EVENT_FD _IO(SIMTEMP_IOCTL_MAGIC, 7)
+#define SIMTEMP_IOC_SET_WAKEUP _IOW(SIMTEMP_IOCTL_MAGIC, 8, struct simtemp_wakeup)
+/* Uploads a profile and switches to the "profile" mode */
+#define SIMTEMP_IOC_SET_PROFILE _IOW(SIMTEMP_IOCTL_MAGIC, 9, struct simtemp_profile)
+#define SIMTEMP_IOC_REPLAY_BEGIN _IOW(SIMTEMP_IOCTL_MAGIC, 10, struct simtemp_replay)
+/* Matched on the command number only, so callers built with another struct size still work */
+#define SIMTEMP_IOC_SET_CONFIG_EXT _IOW(SIMTEMP_IOCTL_MAGIC, 11, struct simtemp_config_ext)
+#define SIMTEMP_IOC_GET_CONFIG_EXT _IOWR(SIMTEMP_IOCTL_MAGIC, 12, struct simtemp_config_ext)
+/* Also matched on the number only */
+#define SIMTEMP_IOC_GET_SNAPSHOT _IOWR(SIMTEMP_IOCTL_MAGIC, 13, struct simtemp_snapshot)
 
 #endif /* NXP_SIMTEMP_IOCTL_H */
\ No newline at end of file
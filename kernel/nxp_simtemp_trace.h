@@ -0,0 +1,204 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM nxp_simtemp
+
+#if !defined(NXP_SIMTEMP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define NXP_SIMTEMP_TRACE_H
+
+#include <linux/tracepoint.h>
+
+struct simtemp_device;
+
+/*
+ * Sample lifecycle tracepoints, see /sys/kernel/tracing/events/nxp_simtemp/.
+ * Every event carries the instance number of /dev/simtemp<id>.
+ */
+
+/* Where a sample was lost, for simtemp_sample_dropped */
+#define SIMTEMP_DROP_HISTORY 0 /* Overwritten before a reader got to it */
+#define SIMTEMP_DROP_RING    1 /* mmap() ring full */
+#define SIMTEMP_DROP_DEFER   2 /* Producer thread fell behind the timer */
+
+DECLARE_EVENT_CLASS(simtemp_sample_class,
+
+	TP_PROTO(int id, u64 seq, u64 timestamp_ns, s32 temp_mC, u32 flags),
+
+	TP_ARGS(id, seq, timestamp_ns, temp_mC, flags),
+
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(u64, seq)
+		__field(u64, timestamp_ns)
+		__field(s32, temp_mC)
+		__field(u32, flags)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->seq = seq;
+		__entry->timestamp_ns = timestamp_ns;
+		__entry->temp_mC = temp_mC;
+		__entry->flags = flags;
+	),
+
+	TP_printk("simtemp%d seq=%llu ts=%llu temp_mC=%d flags=%#x",
+		  __entry->id, __entry->seq, __entry->timestamp_ns,
+		  __entry->temp_mC, __entry->flags)
+);
+
+/* A raw sample was generated; seq counts raw samples */
+DEFINE_EVENT(simtemp_sample_class, simtemp_sample_generated,
+	TP_PROTO(int id, u64 seq, u64 timestamp_ns, s32 temp_mC, u32 flags),
+	TP_ARGS(id, seq, timestamp_ns, temp_mC, flags)
+);
+
+/* A record was published in the history ring; seq is its history sequence number */
+DEFINE_EVENT(simtemp_sample_class, simtemp_sample_enqueued,
+	TP_PROTO(int id, u64 seq, u64 timestamp_ns, s32 temp_mC, u32 flags),
+	TP_ARGS(id, seq, timestamp_ns, temp_mC, flags)
+);
+
+TRACE_EVENT(simtemp_sample_dropped,
+
+	TP_PROTO(int id, int reason, u64 count),
+
+	TP_ARGS(id, reason, count),
+
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(int, reason)
+		__field(u64, count)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->reason = reason;
+		__entry->count = count;
+	),
+
+	TP_printk("simtemp%d reason=%s count=%llu", __entry->id,
+		  __print_symbolic(__entry->reason,
+				   { SIMTEMP_DROP_HISTORY, "history" },
+				   { SIMTEMP_DROP_RING, "ring" },
+				   { SIMTEMP_DROP_DEFER, "defer" }),
+		  __entry->count)
+);
+
+/* read() copied @count records starting at history sequence @seq */
+TRACE_EVENT(simtemp_sample_read,
+
+	TP_PROTO(int id, u64 seq, size_t count, u32 format),
+
+	TP_ARGS(id, seq, count, format),
+
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(u64, seq)
+		__field(size_t, count)
+		__field(u32, format)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->seq = seq;
+		__entry->count = count;
+		__entry->format = format;
+	),
+
+	TP_printk("simtemp%d seq=%llu count=%zu format=%u",
+		  __entry->id, __entry->seq, __entry->count, __entry->format)
+);
+
+/* The alarm state changed: @rising is true when raised, false when cleared */
+TRACE_EVENT(simtemp_threshold_crossed,
+
+	TP_PROTO(int id, u64 timestamp_ns, s32 temp_mC, s32 threshold_mC, bool rising),
+
+	TP_ARGS(id, timestamp_ns, temp_mC, threshold_mC, rising),
+
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(u64, timestamp_ns)
+		__field(s32, temp_mC)
+		__field(s32, threshold_mC)
+		__field(bool, rising)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->timestamp_ns = timestamp_ns;
+		__entry->temp_mC = temp_mC;
+		__entry->threshold_mC = threshold_mC;
+		__entry->rising = rising;
+	),
+
+	TP_printk("simtemp%d ts=%llu temp_mC=%d threshold_mC=%d %s",
+		  __entry->id, __entry->timestamp_ns, __entry->temp_mC,
+		  __entry->threshold_mC, __entry->rising ? "rising" : "falling")
+);
+
+/*
+ * The configuration after any part of it changed. The event takes the
+ * device itself rather than one argument per setting: BPF raw tracepoints
+ * are limited to 12 arguments, and the snapshot only grows.
+ */
+TRACE_EVENT(simtemp_config_changed,
+
+	TP_PROTO(const struct simtemp_device *sdev),
+
+	TP_ARGS(sdev),
+
+	TP_STRUCT__entry(
+		__field(int, id)
+		__field(u32, sampling_us)
+		__field(s32, threshold_mC)
+		__field(s32, hysteresis_mC)
+		__field(int, alert_mode)
+		__field(u32, aggregate)
+		__field(u32, wake_watermark)
+		__field(u32, wake_timeout_us)
+		__field(int, mode)
+		__field(int, ts_clock)
+		__field(int, producer)
+		__field(u32, fifo_depth)
+		__field(int, cpu)
+		__field(bool, shared_timer)
+		__field(bool, phase_continuous)
+		__field(u32, timer_slack_us)
+	),
+
+	TP_fast_assign(
+		__entry->id = sdev->id;
+		__entry->sampling_us = READ_ONCE(sdev->sampling_us);
+		__entry->threshold_mC = READ_ONCE(sdev->threshold_mC);
+		__entry->hysteresis_mC = READ_ONCE(sdev->hysteresis_mC);
+		__entry->alert_mode = READ_ONCE(sdev->alert_mode);
+		__entry->aggregate = READ_ONCE(sdev->aggregate);
+		__entry->wake_watermark = READ_ONCE(sdev->wake_watermark);
+		__entry->wake_timeout_us = READ_ONCE(sdev->wake_timeout_us);
+		__entry->mode = READ_ONCE(sdev->mode);
+		__entry->ts_clock = READ_ONCE(sdev->ts_clock);
+		__entry->producer = READ_ONCE(sdev->producer);
+		__entry->fifo_depth = READ_ONCE(sdev->fifo_depth);
+		__entry->cpu = READ_ONCE(sdev->cpu);
+		__entry->shared_timer = READ_ONCE(sdev->shared_timer);
+		__entry->phase_continuous = READ_ONCE(sdev->phase_continuous);
+		__entry->timer_slack_us = READ_ONCE(sdev->timer_slack_us);
+	),
+
+	TP_printk("simtemp%d sampling_us=%u threshold_mC=%d hysteresis_mC=%d alert_mode=%d aggregate=%u wake_watermark=%u wake_timeout_us=%u mode=%d ts_clock=%d producer=%d fifo_depth=%u cpu=%d shared_timer=%d phase_continuous=%d timer_slack_us=%u",
+		  __entry->id, __entry->sampling_us, __entry->threshold_mC,
+		  __entry->hysteresis_mC, __entry->alert_mode, __entry->aggregate,
+		  __entry->wake_watermark, __entry->wake_timeout_us, __entry->mode,
+		  __entry->ts_clock, __entry->producer, __entry->fifo_depth,
+		  __entry->cpu, __entry->shared_timer, __entry->phase_continuous,
+		  __entry->timer_slack_us)
+);
+
+#endif /* NXP_SIMTEMP_TRACE_H */
+
+/* This part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE nxp_simtemp_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+"""Compares two run_bench.sh result files and flags regressions.
+
+Results are matched on (mode, period_us, readers, aggregate, watermark). A
+combination regresses when its delivered rate drops, its drop rate or
+producer CPU grows, or its p99 latency grows by more than the tolerance.
+Exits 1 if any combination regressed.
+"""
+
+import argparse
+import json
+import sys
+
+KEY = ("mode", "period_us", "readers", "aggregate", "watermark")
+
+
+def load(path):
+    with open(path) as f:
+        return {tuple(r[k] for k in KEY): r for r in map(json.loads, filter(str.strip, f))}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("candidate")
+    parser.add_argument("--tolerance", type=float, default=0.10, help="Relative change allowed (default 0.10).")
+    args = parser.parse_args()
+
+    base, cand = load(args.baseline), load(args.candidate)
+    # (metric, higher is better, absolute floor below which changes are noise)
+    checks = [(lambda r: r["samples_per_s"], True, 1.0),
+              (lambda r: r["drop_rate"], False, 1e-4),
+              (lambda r: r["producer_cpu_pct"], False, 0.5),
+              (lambda r: r["latency_ns"]["p99"], False, 10000)]
+    names = ["samples_per_s", "drop_rate", "producer_cpu_pct", "p99_ns"]
+
+    regressed = False
+    for key in sorted(base.keys() & cand.keys(), key=str):
+        for name, (metric, higher_better, floor) in zip(names, checks):
+            old, new = metric(base[key]), metric(cand[key])
+            if old is None or new is None:
+                continue
+            delta = new - old if not higher_better else old - new
+            if delta > max(floor, abs(old) * args.tolerance):
+                regressed = True
+                print(f"REGRESSION {dict(zip(KEY, key))}: {name} {old} -> {new}")
+
+    for key in sorted(base.keys() - cand.keys(), key=str):
+        print(f"missing from candidate: {dict(zip(KEY, key))}")
+    return 1 if regressed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,405 @@
+/*
+ * simtemp_bench - measures one data path of /dev/simtemp<N>.
+ *
+ * Configures the device, runs N reader threads for a fixed time and prints
+ * one JSON object: delivered samples/s, drop rate (stats attribute), producer
+ * CPU usage (debugfs produce_time_ns) and delivery latency percentiles. The
+ * device settings it touches are restored on exit. See scripts/run_bench.sh
+ * for the sweep.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "simtemp.h"
+
+#define BATCH      4096     /* Samples per read() in the batched modes */
+#define LAT_CAP    (1 << 22) /* Latencies kept per reader, later samples are only counted */
+#define MAX_READERS 64
+#define POLL_MS    100
+
+enum bench_mode {
+	BENCH_SINGLE,    /* One sample per read() */
+	BENCH_BATCH,     /* Up to BATCH samples per read() */
+	BENCH_MMAP,      /* Shared mmap() ring, one consumer */
+	BENCH_AGGREGATE, /* Batched reads of summary records */
+};
+
+static const char * const bench_mode_str[] = {
+	[BENCH_SINGLE] = "single",
+	[BENCH_BATCH] = "batch",
+	[BENCH_MMAP] = "mmap",
+	[BENCH_AGGREGATE] = "aggregate",
+};
+
+struct bench_reader {
+	pthread_t thread;
+	struct simtemp *st;
+	enum bench_mode mode;
+	uint64_t samples;
+	uint64_t overruns;
+	uint64_t *lat_ns;
+	size_t nr_lat;
+	int error;
+};
+
+/* Device counters sampled before and after a run */
+struct bench_counters {
+	uint64_t updates;
+	uint64_t dropped;
+	uint64_t defer_drops;
+	int64_t produce_ns; /* -1 without debugfs */
+	uint64_t wall_ns;
+};
+
+static volatile sig_atomic_t bench_stop;
+
+static uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void bench_record(struct bench_reader *r, const struct simtemp_sample *s, size_t n)
+{
+	uint64_t now = bench_now_ns();
+	size_t i;
+
+	r->samples += n;
+	for (i = 0; i < n && r->nr_lat < LAT_CAP; i++) {
+		/* The device stamps with CLOCK_MONOTONIC for the run, see main() */
+		r->lat_ns[r->nr_lat++] = now > s[i].timestamp_ns ? now - s[i].timestamp_ns : 0;
+	}
+}
+
+static void *bench_reader_thread(void *arg)
+{
+	struct bench_reader *r = arg;
+	struct simtemp_sample *buf;
+	struct pollfd pfd = { .fd = simtemp_fd(r->st), .events = POLLIN };
+	size_t max = r->mode == BENCH_SINGLE ? 1 : BATCH;
+	ssize_t n;
+
+	buf = malloc(BATCH * sizeof(*buf));
+	if (!buf){
+		r->error = -ENOMEM;
+		return NULL;
+	}
+
+	while (!bench_stop) {
+		if (poll(&pfd, 1, POLL_MS) < 0 && errno != EINTR) {
+			r->error = -errno;
+			break;
+		}
+		/* Drain everything queued before sleeping again */
+		for (;;) {
+			if (r->mode == BENCH_MMAP){
+				n = simtemp_ring_read(r->st, buf, max);
+			} else {
+				n = simtemp_read(r->st, buf, max);
+			}
+			if (n == -EAGAIN || n == 0){
+				break;
+			}
+			if (n < 0) {
+				r->error = n;
+				goto out;
+			}
+			bench_record(r, buf, n);
+		}
+	}
+
+out:
+	free(buf);
+	return NULL;
+}
+
+static int bench_attr_set(struct simtemp *st, const char *attr, const char *value)
+{
+	int ret = simtemp_attr_write(st, attr, value);
+
+	if (ret){
+		fprintf(stderr, "simtemp_bench: cannot set %s=%s: %s\n", attr, value, strerror(-ret));
+	}
+	return ret;
+}
+
+/* The producer time only exists in debugfs metrics */
+static int64_t bench_produce_ns(const char *name)
+{
+	char path[256], line[128];
+	int64_t val = -1;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/kernel/debug/nxp_simtemp/%s/metrics", name);
+	f = fopen(path, "r");
+	if (!f){
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "produce_time_ns: %" SCNd64, &val) == 1){
+			break;
+		}
+	}
+	fclose(f);
+	return val;
+}
+
+static int bench_counters(struct simtemp *st, const char *name, struct bench_counters *c)
+{
+	char buf[256];
+	int ret;
+
+	ret = simtemp_attr_read(st, "stats", buf, sizeof(buf));
+	if (ret){
+		return ret;
+	}
+	if (sscanf(buf, "updates=%" SCNu64 " alerts=%*u last_error=%*d dropped=%" SCNu64 " defer_drops=%" SCNu64,
+		   &c->updates, &c->dropped, &c->defer_drops) != 3){
+		return -EPROTO;
+	}
+	c->produce_ns = bench_produce_ns(name);
+	c->wall_ns = bench_now_ns();
+	return 0;
+}
+
+static int bench_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of a sorted array */
+static uint64_t bench_pct(const uint64_t *v, size_t n, double pct)
+{
+	size_t rank;
+
+	if (!n){
+		return 0;
+	}
+	rank = (size_t)(pct / 100.0 * n + 0.999999);
+	return v[(rank ? rank : 1) - 1];
+}
+
+static void bench_usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d device] [-m single|batch|mmap|aggregate] [-p period_us] [-r readers]\n"
+		"          [-t seconds] [-a aggregate] [-w watermark] [-l label]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dev = SIMTEMP_DEFAULT_PATH, *label = "", *name;
+	enum bench_mode mode = BENCH_BATCH;
+	unsigned int period_us = 100, nr_readers = 1, aggregate = 10, watermark = 64;
+	double seconds = 5.0, wall_s, cpu_pct = -1.0, drop_rate;
+	char saved_period[32], saved_agg[32], saved_wm[32], saved_clock[32], val[32];
+	struct bench_reader readers[MAX_READERS] = { 0 };
+	struct bench_counters before, after;
+	struct simtemp *ctl;
+	uint64_t *lat, samples = 0, overruns = 0, records, dropped;
+	size_t nr_lat = 0;
+	unsigned int i;
+	int opt, ret = 1, err;
+
+	while ((opt = getopt(argc, argv, "d:m:p:r:t:a:w:l:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'm':
+			for (i = 0; i < sizeof(bench_mode_str) / sizeof(bench_mode_str[0]); i++) {
+				if (!strcmp(optarg, bench_mode_str[i])){
+					break;
+				}
+			}
+			if (i == sizeof(bench_mode_str) / sizeof(bench_mode_str[0])) {
+				bench_usage(argv[0]);
+				return 2;
+			}
+			mode = i;
+			break;
+		case 'p':
+			period_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			nr_readers = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtod(optarg, NULL);
+			break;
+		case 'a':
+			aggregate = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			watermark = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			label = optarg;
+			break;
+		default:
+			bench_usage(argv[0]);
+			return 2;
+		}
+	}
+	if (!nr_readers || nr_readers > MAX_READERS || seconds <= 0) {
+		bench_usage(argv[0]);
+		return 2;
+	}
+	if (mode == BENCH_MMAP && nr_readers != 1) {
+		/* The ring has a single consumer tail */
+		fprintf(stderr, "simtemp_bench: mmap mode supports exactly one reader\n");
+		return 2;
+	}
+	if (mode == BENCH_SINGLE){
+		watermark = 1;
+	}
+	if (mode != BENCH_AGGREGATE){
+		aggregate = 1;
+	}
+	name = strrchr(dev, '/') ? strrchr(dev, '/') + 1 : dev;
+
+	ctl = simtemp_open(dev, SIMTEMP_OPEN_NONBLOCK);
+	if (!ctl) {
+		fprintf(stderr, "simtemp_bench: %s: %s\n", dev, strerror(errno));
+		return 1;
+	}
+
+	if (simtemp_attr_read(ctl, "sampling_us", saved_period, sizeof(saved_period)) ||
+	    simtemp_attr_read(ctl, "aggregate", saved_agg, sizeof(saved_agg)) ||
+	    simtemp_attr_read(ctl, "wake_watermark", saved_wm, sizeof(saved_wm)) ||
+	    simtemp_attr_read(ctl, "current_timestamp_clock", saved_clock, sizeof(saved_clock))) {
+		fprintf(stderr, "simtemp_bench: cannot read the device configuration: %s\n", strerror(errno));
+		goto close_ctl;
+	}
+
+	/* Latency is measured against CLOCK_MONOTONIC in this process */
+	if (bench_attr_set(ctl, "current_timestamp_clock", "monotonic")){
+		goto restore;
+	}
+	snprintf(val, sizeof(val), "%u", period_us);
+	if (bench_attr_set(ctl, "sampling_us", val)){
+		goto restore;
+	}
+	snprintf(val, sizeof(val), "%u", aggregate);
+	if (bench_attr_set(ctl, "aggregate", val)){
+		goto restore;
+	}
+	snprintf(val, sizeof(val), "%u", watermark);
+	if (bench_attr_set(ctl, "wake_watermark", val)){
+		goto restore;
+	}
+
+	for (i = 0; i < nr_readers; i++) {
+		readers[i].mode = mode;
+		readers[i].lat_ns = malloc(LAT_CAP * sizeof(uint64_t));
+		readers[i].st = simtemp_open(dev, SIMTEMP_OPEN_NONBLOCK);
+		if (!readers[i].lat_ns || !readers[i].st) {
+			fprintf(stderr, "simtemp_bench: reader %u: %s\n", i, strerror(errno ? errno : ENOMEM));
+			goto free_readers;
+		}
+		if (mode == BENCH_MMAP && (err = simtemp_ring_map(readers[i].st))) {
+			fprintf(stderr, "simtemp_bench: mmap: %s\n", strerror(-err));
+			goto free_readers;
+		}
+	}
+
+	if ((err = bench_counters(ctl, name, &before))) {
+		fprintf(stderr, "simtemp_bench: cannot read stats: %s\n", strerror(-err));
+		goto free_readers;
+	}
+	for (i = 0; i < nr_readers; i++) {
+		pthread_create(&readers[i].thread, NULL, bench_reader_thread, &readers[i]);
+	}
+
+	usleep((useconds_t)(seconds * 1e6));
+	bench_stop = 1;
+	for (i = 0; i < nr_readers; i++) {
+		pthread_join(readers[i].thread, NULL);
+	}
+	if ((err = bench_counters(ctl, name, &after))) {
+		fprintf(stderr, "simtemp_bench: cannot read stats: %s\n", strerror(-err));
+		goto free_readers;
+	}
+
+	for (i = 0; i < nr_readers; i++) {
+		struct simtemp_reader_stats stats;
+
+		if (readers[i].error) {
+			fprintf(stderr, "simtemp_bench: reader %u: %s\n", i, strerror(-readers[i].error));
+			goto free_readers;
+		}
+		if (mode == BENCH_MMAP){
+			readers[i].overruns = simtemp_ring_dropped(readers[i].st);
+		} else if (!simtemp_get_reader_stats(readers[i].st, &stats)){
+			readers[i].overruns = stats.overruns;
+		}
+		samples += readers[i].samples;
+		overruns += readers[i].overruns;
+		nr_lat += readers[i].nr_lat;
+	}
+
+	lat = malloc((nr_lat ? nr_lat : 1) * sizeof(*lat));
+	if (!lat){
+		goto free_readers;
+	}
+	nr_lat = 0;
+	for (i = 0; i < nr_readers; i++) {
+		memcpy(lat + nr_lat, readers[i].lat_ns, readers[i].nr_lat * sizeof(*lat));
+		nr_lat += readers[i].nr_lat;
+	}
+	qsort(lat, nr_lat, sizeof(*lat), bench_cmp_u64);
+
+	wall_s = (after.wall_ns - before.wall_ns) / 1e9;
+	if (before.produce_ns >= 0 && after.produce_ns >= 0){
+		cpu_pct = 100.0 * (after.produce_ns - before.produce_ns) / (after.wall_ns - before.wall_ns);
+	}
+	/* Every reader is owed every record; the device counts drops across all of them */
+	records = (after.updates - before.updates) / aggregate * nr_readers;
+	dropped = (after.dropped - before.dropped) + (after.defer_drops - before.defer_drops);
+	drop_rate = records ? (double)dropped / records : 0.0;
+
+	printf("{\"label\":\"%s\",\"mode\":\"%s\",\"period_us\":%u,\"readers\":%u,\"aggregate\":%u,"
+	       "\"watermark\":%u,\"duration_s\":%.3f,\"samples\":%" PRIu64 ",\"samples_per_s\":%.1f,"
+	       "\"produced\":%" PRIu64 ",\"dropped\":%" PRIu64 ",\"drop_rate\":%.6f,"
+	       "\"reader_overruns\":%" PRIu64 ",",
+	       label, bench_mode_str[mode], period_us, nr_readers, aggregate, watermark, wall_s,
+	       samples, samples / wall_s, after.updates - before.updates, dropped, drop_rate, overruns);
+	if (cpu_pct >= 0){
+		printf("\"producer_cpu_pct\":%.3f,", cpu_pct);
+	} else {
+		printf("\"producer_cpu_pct\":null,");
+	}
+	printf("\"latency_ns\":{\"p50\":%" PRIu64 ",\"p99\":%" PRIu64 ",\"p999\":%" PRIu64 ",\"max\":%" PRIu64 "}}\n",
+	       bench_pct(lat, nr_lat, 50.0), bench_pct(lat, nr_lat, 99.0), bench_pct(lat, nr_lat, 99.9),
+	       nr_lat ? lat[nr_lat - 1] : 0);
+	free(lat);
+	ret = 0;
+
+free_readers:
+	for (i = 0; i < nr_readers; i++) {
+		simtemp_close(readers[i].st);
+		free(readers[i].lat_ns);
+	}
+restore:
+	simtemp_attr_write(ctl, "wake_watermark", saved_wm);
+	simtemp_attr_write(ctl, "aggregate", saved_agg);
+	simtemp_attr_write(ctl, "sampling_us", saved_period);
+	simtemp_attr_write(ctl, "current_timestamp_clock", saved_clock);
+close_ctl:
+	simtemp_close(ctl);
+	return ret;
+}
@@ -10,9 +10,11 @@ KERNEL_DIR_DEFAULT="/lib/modules/$(uname -r)/build"
 KERNEL_DIR="${KDIR:-$KERNEL_DIR_DEFAULT}"
 MODULE_SUBDIR="../kernel"
 CLI_SUBDIR="../user/cli"
+LIB_SUBDIR="../user/lib"
 
 # --- Argument Parsing ---
 MAKE_ARGS=""
+LIB_ARGS=""
 TARGET_INFO="native 64-bit"
 
 # Handle 'clean' as a special case that exits immediately.
@@ -20,6 +22,7 @@ TARGET_INFO="native 64-bit"
 if [[ " $@ " =~ " clean " ]]; then
     echo "--- Cleaning kernel module artifacts in '$MODULE_SUBDIR/'... ---"
     make -C "$MODULE_SUBDIR" KDIR="$KERNEL_DIR" clean
+    make -C "$LIB_SUBDIR" clean
     echo "--- Clean finished ---"
     exit 0
 fi
@@ -29,6 +32,7 @@ for arg in "$@"; do
   case "$arg" in
     build32)
       MAKE_ARGS+=" ARCH=arm CROSS_COMPILE=arm-linux-gnueabihf-"
+      LIB_ARGS+=" CC=arm-linux-gnueabihf-gcc AR=arm-linux-gnueabihf-ar"
       TARGET_INFO="32-bit ARM"
       ;;
     PC)
@@ -83,6 +87,11 @@ make -C "$MODULE_SUBDIR" KDIR="$KERNEL_DIR" $MAKE_ARGS
 
 echo "Kernel module built successfully: $MODULE_SUBDIR/nxp_simtemp.ko"
 
+# Build the consumer library
+echo
+echo "Building libsimtemp in '$LIB_SUBDIR/'..."
+make -C "$LIB_SUBDIR" $LIB_ARGS
+
 # Check user-space app (Python doesn't need building)
 echo
 echo "Checking user-space application in '$CLI_SUBDIR/'..."
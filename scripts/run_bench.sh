@@ -0,0 +1,57 @@
+#!/bin/bash
+
+# run_bench.sh - Sweeps the driver's data paths with simtemp_bench.
+# Must be run with sudo, with the module loaded (PC build: insmod nxp_simtemp.ko).
+# Writes one JSON object per combination; compare two runs with bench_compare.py.
+
+set -e
+
+# --- Configuration (override from the environment) ---
+DEVICE="${DEVICE:-/dev/simtemp0}"
+PERIODS_US="${PERIODS_US:-1000 200 100 50}"
+READERS="${READERS:-1 2 4}"
+MODES="${MODES:-single batch mmap aggregate}"
+DURATION_S="${DURATION_S:-5}"
+AGGREGATE="${AGGREGATE:-10}"
+WATERMARK="${WATERMARK:-64}"
+OUTPUT="${OUTPUT:-../bench_output.txt}"
+BENCH_DIR="./bench"
+BENCH="${BENCH_DIR}/simtemp_bench"
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "ERROR: This script must be run as root (use sudo)." >&2
+    exit 1
+fi
+
+if [ ! -c "$DEVICE" ]; then
+    echo "ERROR: $DEVICE not found. Load the module first." >&2
+    exit 1
+fi
+
+# produce_time_ns, for producer CPU usage, is only reported through debugfs
+if ! mountpoint -q /sys/kernel/debug; then
+    mount -t debugfs none /sys/kernel/debug || echo "Warning: debugfs unavailable, producer_cpu_pct will be null."
+fi
+
+make -C "$BENCH_DIR"
+
+# Label every result with the driver build, so runs of different versions can be told apart
+LABEL="$(cat /sys/module/nxp_simtemp/srcversion 2>/dev/null || echo unknown)"
+
+echo "--- Writing results to $OUTPUT (label $LABEL) ---"
+: > "$OUTPUT"
+for mode in $MODES; do
+    for period in $PERIODS_US; do
+        for readers in $READERS; do
+            # The mmap ring has a single consumer
+            if [ "$mode" == "mmap" ] && [ "$readers" -ne 1 ]; then
+                continue
+            fi
+            echo "mode=$mode period_us=$period readers=$readers"
+            "$BENCH" -d "$DEVICE" -m "$mode" -p "$period" -r "$readers" -t "$DURATION_S" \
+                     -a "$AGGREGATE" -w "$WATERMARK" -l "$LABEL" | tee -a "$OUTPUT"
+        done
+    done
+done
+
+echo "--- Benchmark finished ---"
@@ -9,7 +9,7 @@ set -e
 MODULE_NAME="nxp_simtemp"
 MODULE_PATH="../kernel/${MODULE_NAME}.ko"
 CLI_APP="../user/cli/main.py"
-SYSFS_PATH="/sys/class/misc/simtemp"
+SYSFS_PATH="/sys/class/misc/simtemp0"
 
 # --- Helper Functions ---
 cleanup() {
@@ -49,11 +49,11 @@ insmod "$MODULE_PATH"
 dmesg | tail -n 5
 
 # Verify device creation
-if [ ! -c "/dev/simtemp" ] || [ ! -d "$SYSFS_PATH" ]; then
+if [ ! -c "/dev/simtemp0" ] || [ ! -d "$SYSFS_PATH" ]; then
     echo "FAIL: Device node or sysfs directory not created."
     exit 1
 fi
-echo "Device node /dev/simtemp and sysfs path found."
+echo "Device node /dev/simtemp0 and sysfs path found."
 
 # Run automated test
 echo
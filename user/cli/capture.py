@@ -0,0 +1,173 @@
+"""Chunked columnar capture files for simtemp samples.
+
+Layout (all little-endian, every block padded to 8 bytes):
+
+    header  "<8sHHII12x"  magic, version, flags, chunk_records, clock
+    chunk   "<IHH"        count, encoding, reserved
+            timestamps    count x u64, or u64 first + (count - 1) x u32 deltas
+            temperatures  count x s32, or s32 first + (count - 1) x s16 deltas
+            flags         count x u32, or count x u8
+
+Columns stay in their on-disk form until they are used: plain columns are
+memoryviews into the mapped file, delta columns are decoded with
+itertools.accumulate(), which runs without Python code per sample. The writer
+computes deltas with numpy.diff() when numpy is installed and falls back to a
+per-sample map() otherwise.
+"""
+
+import array
+import itertools
+import mmap
+import operator
+import struct
+import sys
+
+try:
+    import numpy as np
+except ImportError:
+    np = None  # Delta encoding falls back to plain Python
+
+MAGIC = b"SIMTCAP\0"
+VERSION = 1
+HEADER_FORMAT = "<8sHHII12x"
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+CHUNK_FORMAT = "<IHH"
+CHUNK_SIZE = struct.calcsize(CHUNK_FORMAT)  # 8, so every column starts 8-byte aligned
+
+FILE_DELTA = 1 << 0  # Writer tried delta encoding, see the per-chunk encoding
+
+# Per-chunk column encodings
+ENC_TS_DELTA32 = 1 << 0
+ENC_TEMP_DELTA16 = 1 << 1
+ENC_FLAGS_U8 = 1 << 2
+
+# Order of the kernel's current_timestamp_clock values
+CLOCKS = ["realtime", "monotonic", "monotonic_raw", "boottime"]
+
+CHUNK_RECORDS = 4096
+
+if sys.byteorder != "little":
+    raise ImportError("capture files are only supported on little-endian hosts")
+
+
+def _pad(n):
+    return (-n) % 8
+
+
+def _deltas(values, typecode):
+    """Differences between neighbouring values packed as typecode, or None if one does not fit."""
+    if np is not None:
+        deltas = np.diff(np.asarray(values, dtype=np.int64))
+        limits = np.iinfo(typecode)
+        if deltas.min() < limits.min or deltas.max() > limits.max:
+            return None
+        return deltas.astype(typecode).tobytes()
+    try:
+        return array.array(typecode, map(operator.sub, values[1:], values[:-1])).tobytes()
+    except OverflowError:
+        return None  # A jump too large for the narrow type: store this chunk plainly
+
+
+def split_samples(data):
+    """Splits packed struct simtemp_sample records into timestamp, temp and flags arrays."""
+    words = array.array("Q", data)
+    rest = array.array("i", words[1::2].tobytes())
+    return words[0::2], rest[0::2], array.array("I", rest[1::2].tobytes())
+
+
+class CaptureWriter:
+    """Appends columnar chunks to a capture file."""
+
+    def __init__(self, path, clock="realtime", delta=False, chunk_records=CHUNK_RECORDS):
+        self.f = open(path, "wb")
+        self.delta = delta
+        self.chunk_records = chunk_records
+        self.records = 0
+        self.f.write(struct.pack(HEADER_FORMAT, MAGIC, VERSION, FILE_DELTA if delta else 0,
+                                 chunk_records, CLOCKS.index(clock) if clock in CLOCKS else 0))
+
+    def _column(self, values, delta_typecode, plain_typecode, enc_bit):
+        """Returns (bytes, encoding bit) for one column, delta-encoded when it fits."""
+        if self.delta and len(values) > 1:
+            deltas = _deltas(values, delta_typecode)
+            if deltas is not None:
+                return array.array(plain_typecode, values[:1]).tobytes() + deltas, enc_bit
+        return array.array(plain_typecode, values).tobytes(), 0
+
+    def write_chunk(self, ts, temps, flags):
+        count = len(ts)
+        if not count:
+            return
+        ts_col, ts_enc = self._column(ts, "I", "Q", ENC_TS_DELTA32)
+        temp_col, temp_enc = self._column(temps, "h", "i", ENC_TEMP_DELTA16)
+        try:
+            flags_col, flags_enc = array.array("B", flags).tobytes(), ENC_FLAGS_U8
+        except OverflowError:
+            flags_col, flags_enc = array.array("I", flags).tobytes(), 0
+
+        out = [struct.pack(CHUNK_FORMAT, count, ts_enc | temp_enc | flags_enc, 0)]
+        for col in (ts_col, temp_col, flags_col):
+            out.append(col)
+            out.append(b"\0" * _pad(len(col)))
+        self.f.write(b"".join(out))
+        self.records += count
+
+    def write_samples(self, data):
+        """Writes packed struct simtemp_sample records, split into chunks."""
+        ts, temps, flags = split_samples(data)
+        for i in range(0, len(ts), self.chunk_records):
+            j = i + self.chunk_records
+            self.write_chunk(ts[i:j], temps[i:j], flags[i:j])
+
+    def close(self):
+        self.f.close()
+
+
+class CaptureReader:
+    """Memory-maps a capture file and yields its chunks as columns."""
+
+    def __init__(self, path):
+        self.f = open(path, "rb")
+        self.map = mmap.mmap(self.f.fileno(), 0, access=mmap.ACCESS_READ)
+        if len(self.map) < HEADER_SIZE:
+            raise ValueError(f"'{path}' is too short for a capture file")
+        magic, version, self.flags, self.chunk_records, clock = struct.unpack_from(HEADER_FORMAT, self.map)
+        if magic != MAGIC or version != VERSION:
+            raise ValueError(f"'{path}' is not a version {VERSION} simtemp capture")
+        self.clock = CLOCKS[clock] if clock < len(CLOCKS) else "realtime"
+
+    def _column(self, off, count, encoded, delta_typecode, plain_typecode):
+        view = memoryview(self.map)
+        if encoded and count > 1:
+            head_size = array.array(plain_typecode).itemsize
+            size = head_size + (count - 1) * array.array(delta_typecode).itemsize
+            head = view[off:off + head_size].cast(plain_typecode)[0]
+            deltas = view[off + head_size:off + size].cast(delta_typecode)
+            col = array.array(plain_typecode, itertools.accumulate(deltas, initial=head))
+        else:
+            size = count * array.array(plain_typecode).itemsize
+            col = view[off:off + size].cast(plain_typecode)
+        return col, off + size + _pad(size)
+
+    def chunks(self):
+        """Yields (timestamps, temps, flags) per chunk."""
+        off = HEADER_SIZE
+        while off + CHUNK_SIZE <= len(self.map):
+            count, enc, _ = struct.unpack_from(CHUNK_FORMAT, self.map, off)
+            off += CHUNK_SIZE
+            ts, off = self._column(off, count, enc & ENC_TS_DELTA32, "I", "Q")
+            temps, off = self._column(off, count, enc & ENC_TEMP_DELTA16, "h", "i")
+            flags, off = self._column(off, count, False, None, "B" if enc & ENC_FLAGS_U8 else "I")
+            yield ts, temps, flags
+
+    def temperatures(self):
+        """All temperatures as one array, e.g. to replay them through the driver."""
+        temps = array.array("i")
+        for _, chunk_temps, _ in self.chunks():
+            temps.extend(chunk_temps)
+        return temps
+
+    def close(self):
+        """Plain columns are views into the mapping: drop them before closing."""
+        self.map.close()
+        self.f.close()
@@ -1,19 +1,70 @@
 #!/usr/bin/env python3
 
 import argparse
+import array
+import fcntl
+import mmap
 import os
 import struct
 import select
 import sys
+import time
 from datetime import datetime, timezone
 
-DEVICE_PATH = "/dev/simtemp"
-SYSFS_PATH_BASE = "/sys/class/misc/simtemp"
+import capture
+
+# Instance 0 by default, see --device
+DEVICE_PATH = "/dev/simtemp0"
+SYSFS_PATH_BASE = "/sys/class/misc/simtemp0"
 SAMPLE_FORMAT = "<QiI"  # u64 timestamp_ns, s32 temp_mC, u32 flags
 SAMPLE_SIZE = struct.calcsize(SAMPLE_FORMAT)
+READ_BATCH = 256  # Max samples drained per read() syscall
+
+# struct simtemp_ring_header (kernel/nxp_simtemp.h)
+RING_HEADER_FORMAT = "<IIIIQ"  # version, nr_slots, slot_size, data_offset, dropped
+RING_HEAD_OFFSET = 64
+RING_TAIL_OFFSET = 128
+RING_INDEX_FORMAT = "<Q"
+
+# struct simtemp_event, read from the fd returned by SIMTEMP_IOC_GET_EVENT_FD
+EVENT_FORMAT = "<QQiiII"  # timestamp_ns, seq, temp_mC, threshold_mC, flags, reserved
+EVENT_SIZE = struct.calcsize(EVENT_FORMAT)
+SIMTEMP_IOC_GET_EVENT_FD = (ord("S") << 8) | 7  # _IO('S', 7)
+
+# struct simtemp_profile (kernel/nxp_simtemp_ioctl.h)
+PROFILE_FORMAT = "<IIQ"  # count, reserved, temps_mC user pointer
+SIMTEMP_IOC_SET_PROFILE = (1 << 30) | (struct.calcsize(PROFILE_FORMAT) << 16) | (ord("S") << 8) | 9  # _IOW('S', 9, ...)
+
+# struct simtemp_replay (kernel/nxp_simtemp_ioctl.h)
+REPLAY_FORMAT = "<QII"  # count, flags, reserved
+REPLAY_LOOP = 1 << 0
+SIMTEMP_IOC_REPLAY_BEGIN = (1 << 30) | (struct.calcsize(REPLAY_FORMAT) << 16) | (ord("S") << 8) | 10  # _IOW('S', 10, ...)
+# struct simtemp_config_ext (kernel/nxp_simtemp_ioctl.h)
+CONFIG_EXT_FORMAT = "<IIIiiIIIIIII"
+CONFIG_EXT_FIELDS = ("size", "flags", "sampling_us", "threshold_mC", "hysteresis_mC", "mode", "fifo_depth",
+                     "wake_watermark", "wake_timeout_us", "aggregate", "alert_mode", "reserved")
+CONFIG_EXT_SIZE = struct.calcsize(CONFIG_EXT_FORMAT)
+SIMTEMP_IOC_SET_CONFIG_EXT = (1 << 30) | (CONFIG_EXT_SIZE << 16) | (ord("S") << 8) | 11  # _IOW('S', 11, ...)
+SIMTEMP_IOC_GET_CONFIG_EXT = (3 << 30) | (CONFIG_EXT_SIZE << 16) | (ord("S") << 8) | 12  # _IOWR('S', 12, ...)
+# struct simtemp_snapshot (kernel/nxp_simtemp_ioctl.h)
+SNAPSHOT_FORMAT = "<IIQIiiIIIIIIi10QiI"
+SNAPSHOT_FIELDS = ("size", "flags", "timestamp_ns", "sampling_us", "threshold_mC", "hysteresis_mC", "mode",
+                   "fifo_depth", "wake_watermark", "wake_timeout_us", "aggregate", "alert_mode", "cpu",
+                   "updates", "alerts", "dropped", "defer_drops", "timer_ticks", "timer_overruns", "hist_head",
+                   "fifo_hwm", "pending", "overruns", "last_error", "alert_active")
+SNAPSHOT_SIZE = struct.calcsize(SNAPSHOT_FORMAT)
+SIMTEMP_IOC_GET_SNAPSHOT = (3 << 30) | (SNAPSHOT_SIZE << 16) | (ord("S") << 8) | 13  # _IOWR('S', 13, ...)
+MODES = ["normal", "noisy", "ramp", "sine", "square", "profile", "replay"]  # SIMTEMP_MODE_* order
+ALERT_MODES = ["level", "edge"]
+REPLAY_CHUNK = 1 << 20  # Bytes per write() while uploading a trace
+RECORD_BATCH = 4096  # Samples drained per read() by --record
+RECORD_FLUSH_S = 1.0  # Longest a partial chunk is held back by --record
 
 FLAG_NEW_SAMPLE = 1 << 0
 FLAG_THRESHOLD_CROSSED = 1 << 1
+FLAG_SUMMARY = 1 << 2
+FLAG_THRESHOLD_RISING = 1 << 3
+FLAG_THRESHOLD_FALLING = 1 << 4
 
 class SimTempError(Exception):
     pass
@@ -37,10 +88,135 @@ def sysfs_read(attr):
         raise SimTempError(f"Error reading from sysfs '{path}': {e}")
 
 
+def config_get():
+    """Reads the whole device configuration with one ioctl."""
+    buf = bytearray(struct.pack(CONFIG_EXT_FORMAT, CONFIG_EXT_SIZE, *[0] * (len(CONFIG_EXT_FIELDS) - 1)))
+    with open(DEVICE_PATH, "rb", buffering=0) as dev_fd:
+        fcntl.ioctl(dev_fd, SIMTEMP_IOC_GET_CONFIG_EXT, buf, True)
+    return dict(zip(CONFIG_EXT_FIELDS, struct.unpack(CONFIG_EXT_FORMAT, buf)))
+
+def config_set(cfg):
+    """Applies a whole configuration, as returned by config_get(), in one step."""
+    cfg = dict(cfg, size=CONFIG_EXT_SIZE)
+    buf = struct.pack(CONFIG_EXT_FORMAT, *(cfg[name] for name in CONFIG_EXT_FIELDS))
+    with open(DEVICE_PATH, "rb", buffering=0) as dev_fd:
+        fcntl.ioctl(dev_fd, SIMTEMP_IOC_SET_CONFIG_EXT, buf)
+
+def snapshot():
+    """Reads counters, configuration and FIFO state with one ioctl."""
+    buf = bytearray(struct.pack(SNAPSHOT_FORMAT, SNAPSHOT_SIZE, *[0] * (len(SNAPSHOT_FIELDS) - 1)))
+    with open(DEVICE_PATH, "rb", buffering=0) as dev_fd:
+        fcntl.ioctl(dev_fd, SIMTEMP_IOC_GET_SNAPSHOT, buf, True)
+    return dict(zip(SNAPSHOT_FIELDS, struct.unpack(SNAPSHOT_FORMAT, buf)))
+
+def format_timestamp(ts_ns, clock):
+    """ISO 8601 for wall-clock timestamps, seconds since the clock's epoch otherwise."""
+    if clock == "realtime":
+        return datetime.fromtimestamp(ts_ns / 1e9, tz=timezone.utc).isoformat(timespec='milliseconds')
+    return f"{clock} {ts_ns / 1e9:.6f}"
+
+def timestamp_clock():
+    """Returns the device's current_timestamp_clock, realtime for drivers without it."""
+    try:
+        return sysfs_read("current_timestamp_clock")
+    except SimTempError:
+        return "realtime"
+
+def load_profile(path):
+    """Uploads a temperature profile (one milli-Celsius value per line) and selects the profile mode."""
+    try:
+        with open(path) as f:
+            temps = array.array("i", (int(line) for line in f if line.strip() and not line.startswith("#")))
+        if not temps:
+            raise SimTempError(f"Profile '{path}' is empty")
+
+        addr, count = temps.buffer_info()
+        with open(DEVICE_PATH, "rb", buffering=0) as dev_fd:
+            fcntl.ioctl(dev_fd, SIMTEMP_IOC_SET_PROFILE, struct.pack(PROFILE_FORMAT, count, 0, addr))
+    except (IOError, OSError, ValueError) as e:
+        raise SimTempError(f"Error loading profile '{path}': {e}")
+    return count
+
+def replay_trace(path, loop):
+    """Uploads a recorded trace and starts playback at the current sampling period.
+
+    Files ending in .stc are --record captures, .bin raw little-endian s32
+    milli-Celsius values, anything else one value per line.
+    """
+    try:
+        if path.endswith(".stc"):
+            reader = capture.CaptureReader(path)
+            data = reader.temperatures().tobytes()
+            reader.close()
+        elif path.endswith(".bin"):
+            with open(path, "rb") as f:
+                data = f.read()
+            data = data[:len(data) - len(data) % 4]
+        else:
+            with open(path) as f:
+                temps = array.array("i", (int(line) for line in f if line.strip() and not line.startswith("#")))
+            if sys.byteorder != "little":
+                temps.byteswap()
+            data = temps.tobytes()
+        count = len(data) // 4
+        if not count:
+            raise SimTempError(f"Trace '{path}' is empty")
+
+        with open(DEVICE_PATH, "wb", buffering=0) as dev_fd:
+            fcntl.ioctl(dev_fd, SIMTEMP_IOC_REPLAY_BEGIN, struct.pack(REPLAY_FORMAT, count, REPLAY_LOOP if loop else 0, 0))
+            view = memoryview(data)
+            while view:
+                written = dev_fd.write(view[:REPLAY_CHUNK])
+                view = view[written:]
+    except (IOError, OSError, ValueError) as e:
+        raise SimTempError(f"Error replaying '{path}': {e}")
+    return count
+
+def run_record(dev_fd, path, delta, limit):
+    """Drains the device in large batches into a columnar capture file."""
+    writer = capture.CaptureWriter(path, clock=timestamp_clock(), delta=delta)
+    pending = []
+    pending_records = 0
+    last_flush = time.monotonic()
+
+    print(f"Recording {DEVICE_PATH} to '{path}'... Press Ctrl+C to stop.")
+    try:
+        while not limit or writer.records + pending_records < limit:
+            data = os.read(dev_fd.fileno(), SAMPLE_SIZE * RECORD_BATCH)
+            if not data:
+                break
+            data = data[:len(data) - len(data) % SAMPLE_SIZE]
+            if limit:
+                data = data[:(limit - writer.records - pending_records) * SAMPLE_SIZE]
+            pending.append(data)
+            pending_records += len(data) // SAMPLE_SIZE
+            # Write whole chunks, or whatever arrived once a second at low rates
+            if pending_records >= capture.CHUNK_RECORDS or time.monotonic() - last_flush >= RECORD_FLUSH_S:
+                writer.write_samples(b"".join(pending))
+                pending, pending_records = [], 0
+                last_flush = time.monotonic()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        writer.write_samples(b"".join(pending))
+        writer.close()
+    print(f"\nRecorded {writer.records} samples.")
+
+def run_export(path):
+    """Prints a capture file as CSV without decoding it sample by sample into objects."""
+    reader = capture.CaptureReader(path)
+    out = sys.stdout
+    out.write(f"# clock={reader.clock}\ntimestamp_ns,temp_mC,flags\n")
+    for ts, temps, flags in reader.chunks():
+        out.write("".join(map("{},{},{}\n".format, ts, temps, flags)))
+    ts = temps = flags = None # Release the views into the mapping
+    reader.close()
+
 def run_monitor(dev_fd):
     """Monitors the device using poll() and prints readings."""
     poller = select.poll()
     poller.register(dev_fd, select.POLLIN | select.POLLPRI) # Data and high-priority events
+    clock = timestamp_clock()
 
     print("Monitoring /dev/simtemp... Press Ctrl+C to exit.")
     print("-" * 40)
@@ -50,18 +226,23 @@ def run_monitor(dev_fd):
             events = poller.poll() # No timeout, blocks indefinitely
             for fd, event_mask in events:
                 if fd == dev_fd.fileno():
-                    data = os.read(dev_fd.fileno(), SAMPLE_SIZE)
-                    if len(data) == SAMPLE_SIZE:
-                        ts_ns, temp_mc, flags = struct.unpack(SAMPLE_FORMAT, data)
-
-                        ts_utc = datetime.fromtimestamp(ts_ns / 1e9, tz=timezone.utc)
+                    # The driver returns as many whole samples as fit in the buffer
+                    data = os.read(dev_fd.fileno(), SAMPLE_SIZE * READ_BATCH)
+                    usable = len(data) - (len(data) % SAMPLE_SIZE)
+                    for ts_ns, temp_mc, flags in struct.iter_unpack(SAMPLE_FORMAT, data[:usable]):
+                        ts_str = format_timestamp(ts_ns, clock)
                         temp_c = temp_mc / 1000.0
 
                         alert_msg = ""
-                        if flags & FLAG_THRESHOLD_CROSSED:
+                        if flags & FLAG_THRESHOLD_RISING:
+                            alert_msg = " | *** ALERT RAISED ***"
+                        elif flags & FLAG_THRESHOLD_FALLING:
+                            alert_msg = " | alert cleared"
+                        elif flags & FLAG_THRESHOLD_CROSSED:
                             alert_msg = " | *** ALERT ***"
+                        kind = " (mean)" if flags & FLAG_SUMMARY else ""
 
-                        print(f"{ts_utc.isoformat(timespec='milliseconds')} | Temp: {temp_c:6.3f}°C{alert_msg}")
+                        print(f"{ts_str} | Temp: {temp_c:6.3f}°C{kind}{alert_msg}")
 
         except KeyboardInterrupt:
             print("\nMonitoring stopped.")
@@ -71,6 +252,73 @@ def run_monitor(dev_fd):
             break
 
 
+def run_monitor_mmap(dev_fd):
+    """Monitors the device through the shared mmap() ring, using poll() only to sleep."""
+    fd = dev_fd.fileno()
+    clock = timestamp_clock()
+
+    # Map the header page first to learn the ring geometry, then the whole ring
+    with mmap.mmap(fd, mmap.PAGESIZE, mmap.MAP_SHARED, mmap.PROT_READ) as hdr:
+        _, nr_slots, slot_size, data_offset, _ = struct.unpack_from(RING_HEADER_FORMAT, hdr)
+    ring = mmap.mmap(fd, data_offset + nr_slots * slot_size, mmap.MAP_SHARED,
+                     mmap.PROT_READ | mmap.PROT_WRITE)
+
+    poller = select.poll()
+    poller.register(fd, select.POLLIN)
+
+    print(f"Monitoring /dev/simtemp via mmap ring ({nr_slots} slots)... Press Ctrl+C to exit.")
+    print("-" * 40)
+
+    try:
+        (tail,) = struct.unpack_from(RING_INDEX_FORMAT, ring, RING_TAIL_OFFSET)
+        while True:
+            poller.poll()
+            (head,) = struct.unpack_from(RING_INDEX_FORMAT, ring, RING_HEAD_OFFSET)
+
+            while tail != head:
+                offset = data_offset + (tail & (nr_slots - 1)) * slot_size
+                ts_ns, temp_mc, flags = struct.unpack_from(SAMPLE_FORMAT, ring, offset)
+                tail += 1
+
+                ts_str = format_timestamp(ts_ns, clock)
+                alert_msg = " | *** ALERT ***" if flags & FLAG_THRESHOLD_CROSSED else ""
+                print(f"{ts_str} | Temp: {temp_mc / 1000.0:6.3f}°C{alert_msg}")
+
+            # Hand the consumed slots back to the producer
+            struct.pack_into(RING_INDEX_FORMAT, ring, RING_TAIL_OFFSET, tail)
+    except KeyboardInterrupt:
+        print("\nMonitoring stopped.")
+    finally:
+        ring.close()
+
+
+def run_monitor_events(dev_fd):
+    """Prints alert events only, without reading the data stream."""
+    event_fd = fcntl.ioctl(dev_fd, SIMTEMP_IOC_GET_EVENT_FD)
+    clock = timestamp_clock()
+
+    print(f"Monitoring alert events on {DEVICE_PATH}... Press Ctrl+C to exit.")
+    print("-" * 40)
+
+    try:
+        while True:
+            # Blocks until the next alert, data samples never wake us
+            data = os.read(event_fd, EVENT_SIZE * 16)
+            for ts_ns, seq, temp_mc, threshold_mc, flags, _ in struct.iter_unpack(EVENT_FORMAT, data):
+                ts_str = format_timestamp(ts_ns, clock)
+                if flags & FLAG_THRESHOLD_RISING:
+                    kind = "raised"
+                elif flags & FLAG_THRESHOLD_FALLING:
+                    kind = "cleared"
+                else:
+                    kind = "active"
+                print(f"{ts_str} | #{seq} alert {kind}: {temp_mc / 1000.0:6.3f}°C (threshold {threshold_mc / 1000.0:.3f}°C)")
+    except KeyboardInterrupt:
+        print("\nMonitoring stopped.")
+    finally:
+        os.close(event_fd)
+
+
 def run_test_mode():
     """Configures the device for a test and verifies alert behavior."""
     print("--- Running Test Mode ---")
@@ -82,10 +330,12 @@ def run_test_mode():
         sysfs_write("threshold_mC", 30000)
         sysfs_write("mode", "ramp") # Ramp mode ensures threshold will be crossed
 
-        # 2. Open device and set up poller
+        # 2. Open device and ask for an alert-only event fd
         dev_fd = os.open(DEVICE_PATH, os.O_RDONLY)
+        event_fd = fcntl.ioctl(dev_fd, SIMTEMP_IOC_GET_EVENT_FD)
+        os.close(dev_fd) # The event fd keeps the device open
         poller = select.poll()
-        poller.register(dev_fd, select.POLLPRI) # We only care about the alert event
+        poller.register(event_fd, select.POLLIN)
 
         print("Waiting for threshold alert...")
 
@@ -96,44 +346,24 @@ def run_test_mode():
 
         if not events:
             print("TEST FAILED: Timed out waiting for threshold alert.", file=sys.stderr)
-            os.close(dev_fd)
+            os.close(event_fd)
             return 1
 
-        # 4. Verify the event and the data
-        # The key change: loop to read all samples until the trigger sample is found.
-        MAX_SAMPLES_TO_READ = 20 # Safety limit, based on your 11 expected samples
-
-        # After poller.poll() returns, the device is readable.
-        for _ in range(MAX_SAMPLES_TO_READ):
-            data = os.read(dev_fd, SAMPLE_SIZE)
-
-            if len(data) == SAMPLE_SIZE:
-                timestamp_ms, temp_mC, flags = struct.unpack(SAMPLE_FORMAT, data)
-
-                # Check if this sample is the one that caused the trigger
-                if flags & FLAG_THRESHOLD_CROSSED:
-                    print(f"Threshold alert received. Trigger found in sample (Temp: {temp_mC/1000.0:.1f}°C, Flags: {hex(flags)}).")
-                    print("TEST PASSED")
-                    os.close(dev_fd)
-                    return 0
+        # 4. The event itself carries the triggering sample, no data needs to be read
+        data = os.read(event_fd, EVENT_SIZE)
+        os.close(event_fd)
+        if len(data) != EVENT_SIZE:
+            print(f"TEST FAILED: Short read from event fd ({len(data)} bytes).", file=sys.stderr)
+            return 1
 
-                # Log or skip intermediate samples
-                # print(f"Intermediate sample: Temp={temp_mC/1000.0:.1f}C, Flags={hex(flags)}")
+        ts_ns, seq, temp_mC, threshold_mC, flags, _ = struct.unpack(EVENT_FORMAT, data)
+        if not flags & FLAG_THRESHOLD_CROSSED or temp_mC < threshold_mC:
+            print(f"TEST FAILED: Unexpected event (Temp: {temp_mC/1000.0:.1f}°C, Flags: {hex(flags)}).", file=sys.stderr)
+            return 1
 
-            elif len(data) == 0:
-                # If read returns 0 bytes, the buffer is empty
-                break
-
-            else:
-                # Short read but not zero, which is unexpected
-                print(f"TEST FAILED: Short read from device ({len(data)} bytes).", file=sys.stderr)
-                os.close(dev_fd)
-                return 1
-
-        # If the loop finished without finding the flag:
-        print("TEST FAILED: Read all available samples but THRESHOLD_CROSSED flag was never set.", file=sys.stderr)
-        os.close(dev_fd)
-        return 1
+        print(f"Threshold alert received (Temp: {temp_mC/1000.0:.1f}°C, Threshold: {threshold_mC/1000.0:.1f}°C, Flags: {hex(flags)}).")
+        print("TEST PASSED")
+        return 0
 
     except SimTempError as e:
         print(f"TEST FAILED: An error occurred: {e}", file=sys.stderr)
@@ -145,37 +375,161 @@ def run_test_mode():
 
 def main():
     parser = argparse.ArgumentParser(description="CLI for the NXP Virtual Temperature Sensor.")
+    parser.add_argument("--device", type=int, default=0, metavar="N", help="Sensor instance to use (/dev/simtempN).")
     parser.add_argument("--set-period", type=int, metavar="MS", help="Set sampling period in milliseconds.")
+    parser.add_argument("--set-period-us", type=int, metavar="US", help="Set the sampling period in microseconds (min 50).")
     parser.add_argument("--set-threshold", type=int, metavar="mC", help="Set alert threshold in milli-Celsius.")
-    parser.add_argument("--set-mode", choices=["normal", "noisy", "ramp"], help="Set simulation mode.")
+    parser.add_argument("--set-hysteresis", type=int, metavar="mC", help="Clear the alert only below threshold - hysteresis.")
+    parser.add_argument("--set-alert-mode", choices=["level", "edge"], help="Raise POLLPRI for every alert sample or only on transitions.")
+    parser.add_argument("--set-mode", choices=MODES, help="Set simulation mode.")
+    parser.add_argument("--set-seed", type=int, metavar="SEED", help="Reseed the noise generator and restart the stream (0 = random).")
+    parser.add_argument("--set-wave-len", type=int, metavar="N", help="Samples per sine/square cycle.")
+    parser.add_argument("--set-wave-amplitude", type=int, metavar="mC", help="Sine/square amplitude in milli-Celsius.")
+    parser.add_argument("--load-profile", metavar="FILE", help="Replay the temperatures in FILE (one mC value per line).")
+    parser.add_argument("--record", metavar="FILE", help="Record samples to a columnar capture file (.stc).")
+    parser.add_argument("--delta", action="store_true", help="With --record, delta-encode timestamps and temperatures.")
+    parser.add_argument("--count", type=int, metavar="N", help="With --record, stop after N samples.")
+    parser.add_argument("--export", metavar="FILE", help="Print a capture file as CSV.")
+    parser.add_argument("--replay", metavar="FILE", help="Play back a trace (.stc capture, .bin raw s32 mC, else one mC value per line).")
+    parser.add_argument("--replay-loop", action="store_true", help="With --replay, restart the trace at its end instead of stopping.")
+    parser.add_argument("--set-clock", choices=["realtime", "monotonic", "monotonic_raw", "boottime"], help="Select the clock used for sample timestamps.")
+    parser.add_argument("--set-aggregate", type=int, metavar="N", help="Emit one min/max/mean record per N raw samples (1 disables).")
+    parser.add_argument("--set-producer", choices=["hardirq", "softirq", "thread"], help="Select the context that generates samples.")
+    parser.add_argument("--set-fifo-depth", type=int, metavar="N", help="Set the history depth in records (rounded up to a power of two).")
+    parser.add_argument("--set-wake-watermark", type=int, metavar="N", help="Wake blocked readers only once N records are queued.")
+    parser.add_argument("--set-wake-timeout-us", type=int, metavar="US", help="Wake readers anyway once the oldest queued record is this old (0 disables).")
+    parser.add_argument("--set-cpu", type=int, metavar="CPU", help="Pin the instance to a CPU (-1 to unpin).")
+    parser.add_argument("--atomic", action="store_true", help="Apply the period, threshold, hysteresis, alert mode, mode, FIFO depth, wakeup and aggregation options in one ioctl.")
+    parser.add_argument("--show-config", action="store_true", help="Print the whole device configuration.")
     parser.add_argument("--read-stats", action="store_true", help="Read the device statistics.")
+    parser.add_argument("--snapshot", action="store_true", help="Print counters, configuration and FIFO state read in one ioctl.")
     parser.add_argument("--test", action="store_true", help="Run the automated threshold alert test.")
+    parser.add_argument("--events", action="store_true", help="Monitor alert events only, through the event fd.")
+    parser.add_argument("--mmap", action="store_true", help="Monitor through the shared mmap() ring instead of read().")
 
     args = parser.parse_args()
 
+    global DEVICE_PATH, SYSFS_PATH_BASE
+    DEVICE_PATH = f"/dev/simtemp{args.device}"
+    SYSFS_PATH_BASE = f"/sys/class/misc/simtemp{args.device}"
+
+    if args.export:
+        # Offline: works on a copied capture without the module loaded
+        try:
+            run_export(args.export)
+        except (IOError, OSError, ValueError) as e:
+            print(f"Error: {e}", file=sys.stderr)
+            return 1
+        return 0
+
     if not os.path.exists(DEVICE_PATH):
         print(f"Error: Device '{DEVICE_PATH}' not found. Is the module loaded?", file=sys.stderr)
         return 1
 
     try:
+        if args.atomic:
+            # One GET, one SET: the driver validates everything and restarts the timer once
+            cfg = config_get()
+            updates = {"sampling_us": args.set_period_us or (args.set_period and args.set_period * 1000),
+                       "threshold_mC": args.set_threshold, "hysteresis_mC": args.set_hysteresis,
+                       "alert_mode": args.set_alert_mode and ALERT_MODES.index(args.set_alert_mode),
+                       "mode": args.set_mode and MODES.index(args.set_mode), "fifo_depth": args.set_fifo_depth,
+                       "wake_watermark": args.set_wake_watermark, "wake_timeout_us": args.set_wake_timeout_us,
+                       "aggregate": args.set_aggregate}
+            cfg.update((name, value) for name, value in updates.items() if value is not None)
+            config_set(cfg)
+            print("Applied " + ", ".join(f"{name}={value}" for name, value in updates.items() if value is not None))
+            # Handled: keep the per-attribute writes below from repeating them
+            args.set_period = args.set_period_us = args.set_threshold = args.set_hysteresis = None
+            args.set_alert_mode = args.set_mode = args.set_fifo_depth = args.set_wake_watermark = None
+            args.set_wake_timeout_us = args.set_aggregate = None
+
         # Handle configuration arguments
         if args.set_period:
             sysfs_write("sampling_ms", args.set_period)
             print(f"Set sampling period to {args.set_period} ms")
+        if args.set_period_us:
+            sysfs_write("sampling_us", args.set_period_us)
+            print(f"Set sampling period to {args.set_period_us} us")
         if args.set_threshold:
             sysfs_write("threshold_mC", args.set_threshold)
             print(f"Set threshold to {args.set_threshold} mC")
+        if args.set_hysteresis is not None:
+            sysfs_write("hysteresis_mC", args.set_hysteresis)
+            print(f"Set hysteresis to {args.set_hysteresis} mC")
+        if args.set_alert_mode:
+            sysfs_write("alert_mode", args.set_alert_mode)
+            print(f"Set alert mode to '{args.set_alert_mode}'")
+        if args.set_wave_len:
+            sysfs_write("wave_len", args.set_wave_len)
+            print(f"Set wave length to {args.set_wave_len} samples")
+        if args.set_wave_amplitude is not None:
+            sysfs_write("wave_amplitude_mC", args.set_wave_amplitude)
+            print(f"Set wave amplitude to {args.set_wave_amplitude} mC")
+        if args.load_profile:
+            count = load_profile(args.load_profile)
+            print(f"Loaded {count} profile samples from '{args.load_profile}'")
+        if args.replay:
+            count = replay_trace(args.replay, args.replay_loop)
+            print(f"Replaying {count} samples from '{args.replay}'{' in a loop' if args.replay_loop else ''}")
         if args.set_mode:
             sysfs_write("mode", args.set_mode)
             print(f"Set mode to '{args.set_mode}'")
+        if args.set_seed is not None:
+            sysfs_write("seed", args.set_seed)
+            print(f"Set seed to {args.set_seed}")
+        if args.set_clock:
+            sysfs_write("current_timestamp_clock", args.set_clock)
+            print(f"Set timestamp clock to '{args.set_clock}'")
+        if args.set_aggregate:
+            sysfs_write("aggregate", args.set_aggregate)
+            print(f"Set aggregation factor to {args.set_aggregate}")
+        if args.set_producer:
+            sysfs_write("producer", args.set_producer)
+            print(f"Set producer to '{args.set_producer}'")
+        if args.set_fifo_depth:
+            sysfs_write("fifo_depth", args.set_fifo_depth)
+            print(f"Set FIFO depth to {args.set_fifo_depth}")
+        if args.set_wake_watermark:
+            sysfs_write("wake_watermark", args.set_wake_watermark)
+            print(f"Set wakeup watermark to {args.set_wake_watermark} records")
+        if args.set_wake_timeout_us is not None:
+            sysfs_write("wake_timeout_us", args.set_wake_timeout_us)
+            print(f"Set wakeup timeout to {args.set_wake_timeout_us} us")
+        if args.set_cpu is not None:
+            sysfs_write("cpu", args.set_cpu)
+            print(f"Set CPU to {args.set_cpu}")
+        if args.show_config:
+            cfg = config_get()
+            cfg["mode"] = MODES[cfg["mode"]] if cfg["mode"] < len(MODES) else cfg["mode"]
+            cfg["alert_mode"] = ALERT_MODES[cfg["alert_mode"]] if cfg["alert_mode"] < len(ALERT_MODES) else cfg["alert_mode"]
+            for name in CONFIG_EXT_FIELDS[2:-1]:
+                print(f"{name}: {cfg[name]}")
         if args.read_stats:
             stats = sysfs_read("stats")
             print(f"Device Stats: {stats}")
+        if args.snapshot:
+            snap = snapshot()
+            snap["mode"] = MODES[snap["mode"]] if snap["mode"] < len(MODES) else snap["mode"]
+            snap["alert_mode"] = ALERT_MODES[snap["alert_mode"]] if snap["alert_mode"] < len(ALERT_MODES) else snap["alert_mode"]
+            for name in SNAPSHOT_FIELDS[2:]:
+                print(f"{name}: {snap[name]}")
 
         # If no other action is specified, default to monitoring
-        if not any([args.set_period, args.set_threshold, args.set_mode, args.read_stats, args.test]):
-            with open(DEVICE_PATH, "rb",buffering=0) as dev_fd:
-                run_monitor(dev_fd)
+        if not any([args.set_period, args.set_period_us, args.set_threshold, args.set_hysteresis is not None, args.set_alert_mode, args.set_mode, args.set_seed is not None, args.set_wave_len, args.set_wave_amplitude is not None, args.load_profile, args.replay, args.set_clock, args.set_aggregate, args.set_producer, args.set_fifo_depth, args.set_wake_watermark, args.set_wake_timeout_us is not None, args.set_cpu is not None, args.atomic, args.show_config, args.read_stats, args.snapshot, args.test]):
+            if args.record:
+                with open(DEVICE_PATH, "rb", buffering=0) as dev_fd:
+                    run_record(dev_fd, args.record, args.delta, args.count)
+            elif args.events:
+                with open(DEVICE_PATH, "rb", buffering=0) as dev_fd:
+                    run_monitor_events(dev_fd)
+            elif args.mmap:
+                # The consumer writes the ring tail, so the mapping must be read-write
+                with open(DEVICE_PATH, "r+b", buffering=0) as dev_fd:
+                    run_monitor_mmap(dev_fd)
+            else:
+                with open(DEVICE_PATH, "rb",buffering=0) as dev_fd:
+                    run_monitor(dev_fd)
 
         if args.test:
             # sys.exit() is used to return the status code from the test
@@ -184,6 +538,9 @@ def main():
     except SimTempError as e:
         print(f"Error: {e}", file=sys.stderr)
         return 1
+    except (IOError, OSError, ValueError) as e:
+        print(f"Error: {e}", file=sys.stderr)
+        return 1
 
     return 0
 
@@ -1,16 +1,17 @@
 import tkinter as tk
 from tkinter import ttk, messagebox
+import fcntl
 import os
 import sys
 import struct
 import threading
 import time
-from collections import deque
 import subprocess
 
 # We use Matplotlib for the graph, and tkinter to embed the plot
-# You may need to install these libraries: pip install matplotlib
+# You may need to install these libraries: pip install matplotlib (which pulls in numpy)
 try:
+    import numpy as np
     import matplotlib.pyplot as plt
     from matplotlib.backends.backend_tkagg import FigureCanvasTkAgg
     from matplotlib.figure import Figure
@@ -19,29 +20,103 @@ except ImportError:
     sys.exit(1)
 
 # --- Configuration and Constants ---
-DEVICE_PATH = "/dev/simtemp"
+# Sensor instance to display, /dev/simtemp<N>; override with SIMTEMP_INDEX=N
+SIMTEMP_INDEX = int(os.environ.get("SIMTEMP_INDEX", "0"))
+DEVICE_PATH = f"/dev/simtemp{SIMTEMP_INDEX}"
 # Note: The sysfs path might vary depending on how the driver registers its class.
-# Common paths for miscdevice: /sys/class/misc/simtemp or just /sys/module/nxp_simtemp/parameters/
-SYSFS_BASE_PATH = "/sys/class/misc/simtemp/"
+# Common paths for miscdevice: /sys/class/misc/simtemp0 or just /sys/module/nxp_simtemp/parameters/
+SYSFS_BASE_PATH = f"/sys/class/misc/simtemp{SIMTEMP_INDEX}/"
 SYSFS_CONFIG_PATH = {
     "sampling_ms": SYSFS_BASE_PATH + "/sampling_ms",
     "threshold_mC": SYSFS_BASE_PATH + "/threshold_mC",
     "mode": SYSFS_BASE_PATH + "/mode",
 }
-# Binary record format: Q (u64 timestamp), i (s32 temp_mC), I (u32 flags)
+# Binary record format: u64 timestamp, s32 temp_mC, u32 flags
 # Must match the C struct simtemp_sample
-STRUCT_FORMAT = 'QiI'
-RECORD_SIZE = struct.calcsize(STRUCT_FORMAT)
+SAMPLE_DTYPE = np.dtype([("timestamp_ns", "<u8"), ("temp_mC", "<i4"), ("flags", "<u4")])
+RECORD_SIZE = SAMPLE_DTYPE.itemsize
+READ_BATCH = 4096 # Max records per read() syscall; the reader repeats until a short read
+
+# struct simtemp_snapshot (kernel/nxp_simtemp_ioctl.h): counters, config and FIFO state in one ioctl
+SNAPSHOT_FORMAT = "<IIQIiiIIIIIIi10QiI"
+SNAPSHOT_FIELDS = ("size", "flags", "timestamp_ns", "sampling_us", "threshold_mC", "hysteresis_mC", "mode",
+                   "fifo_depth", "wake_watermark", "wake_timeout_us", "aggregate", "alert_mode", "cpu",
+                   "updates", "alerts", "dropped", "defer_drops", "timer_ticks", "timer_overruns", "hist_head",
+                   "fifo_hwm", "pending", "overruns", "last_error", "alert_active")
+SNAPSHOT_SIZE = struct.calcsize(SNAPSHOT_FORMAT)
+SIMTEMP_IOC_GET_SNAPSHOT = (3 << 30) | (SNAPSHOT_SIZE << 16) | (ord("S") << 8) | 13  # _IOWR('S', 13, ...)
+STATS_INTERVAL_MS = 1000
 
 # Flags (matching the kernel module definitions)
 SIMTEMP_FLAG_NEW_SAMPLE = 0x01
 SIMTEMP_FLAG_THRESHOLD_CROSSED = 0x02
 
 # Data visualization settings
-MAX_DATA_POINTS = 100 # Max points to show on the graph
+HISTORY_POINTS = 1 << 20 # Samples kept in the ring, about a minute at 20 kHz
+PLOT_WINDOW_S = 30.0 # Time span shown on the graph
+SCROLL_FRACTION = 0.25 # The x axis jumps ahead by this much of the window when data reaches its edge
+FULL_RES_POINTS = 2000 # Newest samples drawn as they are...
+DECIMATED_POINTS = 2000 # ...older ones in the window are reduced to this many min/max points
+MAX_FPS = 30
 INITIAL_THRESHOLD_mC = 45000
 
 
+class SampleRing:
+    """Preallocated ring of (time, temperature) points, filled by the reader thread."""
+
+    def __init__(self, capacity):
+        self.capacity = capacity
+        self.t = np.zeros(capacity, dtype=np.float64)
+        self.temp = np.zeros(capacity, dtype=np.float32)
+        self.head = 0  # Points ever written
+        self.lock = threading.Lock()
+
+    def extend(self, t, temp):
+        t, temp = t[-self.capacity:], temp[-self.capacity:]
+        n = len(t)
+        with self.lock:
+            start = self.head % self.capacity
+            first = min(n, self.capacity - start)
+            self.t[start:start + first] = t[:first]
+            self.temp[start:start + first] = temp[:first]
+            self.t[:n - first] = t[first:]
+            self.temp[:n - first] = temp[first:]
+            self.head += n
+
+    def latest(self):
+        """Time of the newest point, None while the ring is empty."""
+        with self.lock:
+            return self.t[(self.head - 1) % self.capacity] if self.head else None
+
+    def since(self, t_min):
+        """Copies out the points at or after t_min, oldest first."""
+        with self.lock:
+            n = min(self.head, self.capacity)
+            start = (self.head - n) % self.capacity
+            # At most two contiguous segments: up to the end of the arrays, then from 0
+            segments = [(start, min(start + n, self.capacity)), (0, max(0, start + n - self.capacity))]
+            parts = []
+            for lo, hi in segments:
+                lo += int(np.searchsorted(self.t[lo:hi], t_min))
+                parts.append((self.t[lo:hi], self.temp[lo:hi]))
+            return (np.concatenate([p[0] for p in parts]), np.concatenate([p[1] for p in parts]))
+
+
+def decimate(t, temp):
+    """Keeps the newest FULL_RES_POINTS as they are and reduces older ones to min/max pairs."""
+    old = len(t) - FULL_RES_POINTS
+    if old <= DECIMATED_POINTS:
+        return t, temp
+    bucket = -(-old // (DECIMATED_POINTS // 2))
+    skip = old % bucket  # The oldest points that do not fill a bucket are left out
+    bt = t[skip:old].reshape(-1, bucket)
+    by = temp[skip:old].reshape(-1, bucket)
+    # Both extremes of every bucket, so spikes survive the decimation
+    dt = np.repeat(bt[:, 0], 2)
+    dy = np.column_stack((by.min(axis=1), by.max(axis=1))).ravel()
+    return np.concatenate((dt, t[old:])), np.concatenate((dy, temp[old:]))
+
+
 class SensorMonitorApp:
     def __init__(self, master):
         self.master = master
@@ -55,13 +130,26 @@ class SensorMonitorApp:
         # State Variables
         self.running = threading.Event()
         self.running.set()
-        self.temp_data = deque(maxlen=MAX_DATA_POINTS)
-        self.time_data = deque(maxlen=MAX_DATA_POINTS)
+        self.ring = SampleRing(HISTORY_POINTS)
+        self.start_ns = None # Timestamp of the first sample, t = 0 on the graph
+        self.alert = False # Set by the reader from the newest sample
         self.alert_status = tk.StringVar(value="OK")
         self.threshold_C = tk.DoubleVar(value=INITIAL_THRESHOLD_mC / 1000.0)
         self.sampling_ms = tk.IntVar(value=100)
         self.mode_var = tk.StringVar(value="normal")
         self.fatal_error = None # Channel for thread errors
+        self.stats_text = tk.StringVar(value="")
+        self.dev_fd = None # The reader thread's fd, also used for the snapshot ioctl
+
+        # The reader thread wakes the Tk loop through this pipe, only when new data arrived
+        self.notify_r, self.notify_w = os.pipe()
+        os.set_blocking(self.notify_r, False)
+        self.notify_pending = threading.Event()
+        master.tk.createfilehandler(self.notify_r, tk.READABLE, self.on_data)
+        self.redraw_pending = False
+        self.last_draw = 0.0
+        self.x_right = None # Right edge of the x axis, moved in SCROLL_FRACTION steps
+        self.background = None # Axes without the data line, for blitting
 
         # UI Setup
         self.setup_ui(master)
@@ -71,8 +159,7 @@ class SensorMonitorApp:
         self.read_thread.daemon = True # Allows thread to exit when main thread exits
         self.read_thread.start()
 
-        # Start UI updates
-        self.update_plot()
+        # Start UI updates; the plot is redrawn from on_data()
         self.update_stats()
 
         # Initial config read (if module is already loaded)
@@ -110,10 +197,13 @@ class SensorMonitorApp:
 
         # 4. Mode Selector
         ttk.Label(control_frame, text="Sensor Mode:", font=("Inter", 12)).pack(pady=(10, 0))
-        mode_options = ["normal", "noisy", "ramp"]
+        mode_options = ["normal", "noisy", "ramp", "sine", "square"]
         self.mode_selector = ttk.OptionMenu(control_frame, self.mode_var, self.mode_var.get(), *mode_options, command=self.set_mode)
         self.mode_selector.pack(pady=5)
 
+        # 5. Device counters, refreshed by update_stats()
+        ttk.Label(control_frame, textvariable=self.stats_text, font=("Inter", 10), justify=tk.LEFT).pack(pady=(15, 0))
+
         # --- Graph Panel (Right) ---
         self.fig = Figure(figsize=(7, 5), dpi=100)
         self.ax = self.fig.add_subplot(111)
@@ -121,11 +211,13 @@ class SensorMonitorApp:
         self.ax.set_ylabel("Temperature (°C)")
         self.ax.set_xlabel("Time (s)")
 
-        self.line, = self.ax.plot([], [], label="Temperature", color="#1f77b4")
+        # Animated: full draws leave the line out, and redraw() blits it over the saved background
+        self.line, = self.ax.plot([], [], label="Temperature", color="#1f77b4", animated=True)
         self.threshold_line = self.ax.axhline(self.threshold_C.get(), color='r', linestyle='--', label="Threshold")
         self.ax.legend(loc='upper left')
 
         self.canvas = FigureCanvasTkAgg(self.fig, master=graph_frame)
+        self.canvas.mpl_connect("draw_event", self.on_draw)
         self.canvas_widget = self.canvas.get_tk_widget()
         self.canvas_widget.pack(fill=tk.BOTH, expand=True)
 
@@ -220,41 +312,46 @@ class SensorMonitorApp:
         try:
             # The core issue is that this OS call may block and definitely needs permissions.
             fd = os.open(DEVICE_PATH, os.O_RDONLY | os.O_NONBLOCK)
+            self.dev_fd = fd
         except FileNotFoundError:
             self.fatal_error = f"Cannot find device file: {DEVICE_PATH}.\nIs the kernel module loaded?"
             self.running.clear()
+            self.notify_ui()
             return
         except PermissionError:
             # Store the permission error message for the main thread to display
             # Note: sys.argv[0] gives the path to the executed script (app.py)
             self.fatal_error = f"Permission denied accessing {DEVICE_PATH}. Please run with elevated privileges.\n(E.g., using 'sudo /path/to/venv/bin/python3 {sys.argv[0]}')"
             self.running.clear()
+            self.notify_ui()
             return
         except Exception as e:
             self.fatal_error = f"Failed to open device: {e}"
             self.running.clear()
+            self.notify_ui()
             return
 
         while self.running.is_set():
+            chunks = []
             try:
-                # Use select/poll to wait for data (more efficient than busy-waiting with sleep)
-                r, _, _ = select.select([fd], [], [], 0.05) # Wait up to 50ms for readability
-
-                if r:
-                    binary_data = os.read(fd, RECORD_SIZE)
-
-                    if len(binary_data) == RECORD_SIZE:
-                        self.process_sample(binary_data)
-
-                # Small sleep ensures the loop isn't a tight busy-wait if select fails or data is sparse
-                time.sleep(0.01)
+                # Sleep in select() until the driver has data; the timeout only bounds shutdown
+                r, _, _ = select.select([fd], [], [], 0.2)
+                if not r:
+                    continue
+
+                # Drain everything queued: a short read means the queue is empty
+                while True:
+                    binary_data = os.read(fd, RECORD_SIZE * READ_BATCH)
+                    chunks.append(binary_data)
+                    if len(binary_data) < RECORD_SIZE * READ_BATCH:
+                        break
+                self.process_samples(b"".join(chunks))
 
             except BlockingIOError:
-                # No data ready, continue loop
-                time.sleep(0.01)
+                # Woken without data (another reader's wakeup), or drained exactly at a batch boundary
+                if chunks:
+                    self.process_samples(b"".join(chunks))
                 continue
-            except struct.error as e:
-                print(f"Error unpacking binary data: {e}")
 
             except Exception as e:
                 # Log unexpected errors but continue the loop if possible
@@ -262,93 +359,140 @@ class SensorMonitorApp:
                 time.sleep(0.1)
 
         if fd is not None:
+            self.dev_fd = None
             os.close(fd)
 
-
-    def process_sample(self, binary_data):
-        """Unpacks binary data and updates the state queues."""
-        try:
-            timestamp_ns, temp_mC, flags = struct.unpack(STRUCT_FORMAT, binary_data)
-        except struct.error:
-            # Occurs if read() didn't return the full record size
+    def process_samples(self, binary_data):
+        """Converts a batch of binary records into the ring, then wakes the UI once."""
+        records = np.frombuffer(binary_data, dtype=SAMPLE_DTYPE, count=len(binary_data) // RECORD_SIZE)
+        if not len(records):
             return
+        if self.start_ns is None:
+            self.start_ns = int(records["timestamp_ns"][0])
 
-        # Convert units for display
-        timestamp_s = timestamp_ns / 1_000_000_000.0
-        temp_C = temp_mC / 1000.0
+        t = (records["timestamp_ns"].astype(np.int64) - self.start_ns) * 1e-9
+        self.ring.extend(t, records["temp_mC"] * 1e-3)
 
-        # Check for alert status (SIMTEMP_FLAG_THRESHOLD_CROSSED is bit 1, or 0x02)
-        is_alert = (flags & SIMTEMP_FLAG_THRESHOLD_CROSSED) != 0
-
-        # Update data queues
-        if not self.time_data:
-            self.start_time = timestamp_s
-
-        relative_time = timestamp_s - self.start_time
-        self.time_data.append(relative_time)
-        self.temp_data.append(temp_C)
-
-        # Update alert status (safe across threads via tkinter variables)
-        if is_alert:
-            self.alert_status.set("ALERT")
-            self.alert_display.config(foreground="red")
-            print(f"ALERT: {temp_C:.2f}C at {relative_time:.2f}s")
-        else:
-            self.alert_status.set("OK")
-            self.alert_display.config(foreground="green")
+        # Alert status follows the newest sample (SIMTEMP_FLAG_THRESHOLD_CROSSED is bit 1, or 0x02)
+        alert = bool(records["flags"][-1] & SIMTEMP_FLAG_THRESHOLD_CROSSED)
+        if alert and not self.alert:
+            print(f"ALERT: {records['temp_mC'][-1] / 1000.0:.2f}C at {t[-1]:.2f}s")
+        self.alert = alert
+        self.notify_ui()
 
-        # Ensure we redraw the plot soon
-        self.master.event_generate("<<DataUpdated>>")
+    def notify_ui(self):
+        """Wakes the Tk loop, unless a wakeup is still waiting to be handled."""
+        if not self.notify_pending.is_set():
+            self.notify_pending.set()
+            os.write(self.notify_w, b"\0")
 
 
     # --- UI Update Methods ---
-    def update_plot(self):
-        """Updates the Matplotlib plot from the data queues."""
+    def on_data(self, fd, mask):
+        """Runs in the Tk loop when the reader thread signals new data (or a fatal error)."""
+        try:
+            os.read(self.notify_r, 64)
+        except BlockingIOError:
+            pass
+        # Cleared before the ring is read, so data arriving from now on signals again
+        self.notify_pending.clear()
 
         # CRITICAL: Check for fatal error signaled from the worker thread
         if self.fatal_error:
             messagebox.showerror("Fatal Error", self.fatal_error)
             self.on_close()
             return
+        self.schedule_redraw()
 
-        if self.time_data:
-            self.line.set_data(list(self.time_data), list(self.temp_data))
+    def schedule_redraw(self):
+        """Coalesces redraw requests to at most MAX_FPS."""
+        if self.redraw_pending:
+            return
+        self.redraw_pending = True
+        delay = max(0.0, self.last_draw + 1.0 / MAX_FPS - time.monotonic())
+        self.master.after(int(delay * 1000), self.redraw)
 
-            # --- FIX: Only set xlim if there are at least two data points ---
-            if len(self.time_data) >= 2:
-                self.ax.set_xlim(self.time_data[0], self.time_data[-1])
-            elif len(self.time_data) == 1:
-                # If only one point exists, expand the x-axis slightly to show it
-                t = self.time_data[0]
-                self.ax.set_xlim(t - 1, t + 1)
-            # ------------------------------------------------------------------
+    def on_draw(self, event):
+        """After every full draw: save the background and put the line back on top."""
+        self.background = self.canvas.copy_from_bbox(self.fig.bbox)
+        self.ax.draw_artist(self.line)
 
-            y_min = min(self.temp_data) - 1 if self.temp_data else 30
-            y_max = max(self.temp_data) + 1 if self.temp_data else 60
+    def redraw(self):
+        """Updates the line with set_data() and blits it; axes are only redrawn when they must move."""
+        self.redraw_pending = False
+        self.last_draw = time.monotonic()
 
-            # Ensure the threshold line is visible
-            current_threshold = self.threshold_C.get()
-            y_min = min(y_min, current_threshold - 1)
-            y_max = max(y_max, current_threshold + 1)
+        if self.alert:
+            self.alert_status.set("ALERT")
+            self.alert_display.config(foreground="red")
+        else:
+            self.alert_status.set("OK")
+            self.alert_display.config(foreground="green")
 
+        latest = self.ring.latest()
+        if latest is None:
+            return
+        full = self.background is None
+        if self.x_right is None or latest > self.x_right:
+            self.x_right = max(latest, PLOT_WINDOW_S * (1 - SCROLL_FRACTION)) + PLOT_WINDOW_S * SCROLL_FRACTION
+            self.ax.set_xlim(self.x_right - PLOT_WINDOW_S, self.x_right)
+            full = True
+
+        t, temp = self.ring.since(self.x_right - PLOT_WINDOW_S)
+        if not len(t):
+            return
+        t, temp = decimate(t, temp)
+        self.line.set_data(t, temp)
+
+        # Grow the y axis when the data leaves it, fit it again whenever the x axis moves
+        current_threshold = self.threshold_C.get()
+        y_min = min(float(temp.min()), current_threshold) - 1
+        y_max = max(float(temp.max()), current_threshold) + 1
+        low, high = self.ax.get_ylim()
+        if full or y_min < low or y_max > high:
             self.ax.set_ylim(y_min, y_max)
+            full = True
 
-            self.canvas.draw_idle()
-
-        # Schedule the next update
-        self.master.after(100, self.update_plot)
+        if full:
+            self.canvas.draw() # on_draw() saves the new background
+        else:
+            self.canvas.restore_region(self.background)
+            self.ax.draw_artist(self.line)
+            self.canvas.blit(self.fig.bbox)
 
     def update_stats(self):
-        """A simple method that could be used for other status updates (e.g., stats counter)."""
-        # This is where you would periodically read the 'stats' sysfs file.
-        # For simplicity, we just schedule the next update.
-        self.master.after(500, self.update_stats)
+        """Refreshes the counters with one snapshot ioctl instead of a sysfs read per attribute.
+
+        The ioctl goes through the reader's fd rather than a second open file,
+        which would keep the device runtime-active (idle_stop) on its own.
+        """
+        fd = self.dev_fd
+        try:
+            if fd is None:
+                self.stats_text.set("") # Reader has not opened the device yet
+                return
+            buf = bytearray(struct.pack(SNAPSHOT_FORMAT, SNAPSHOT_SIZE, *[0] * (len(SNAPSHOT_FIELDS) - 1)))
+            fcntl.ioctl(fd, SIMTEMP_IOC_GET_SNAPSHOT, buf, True)
+            snap = dict(zip(SNAPSHOT_FIELDS, struct.unpack(SNAPSHOT_FORMAT, buf)))
+            self.stats_text.set(f"Samples: {snap['updates']}\n"
+                                f"Alerts: {snap['alerts']}\n"
+                                f"Dropped: {snap['dropped']}\n"
+                                f"FIFO high-water: {snap['fifo_hwm']}/{snap['fifo_depth']}\n"
+                                f"Period: {snap['sampling_us']} us")
+        except OSError:
+            # The module went away under the reader
+            self.stats_text.set("")
+        finally:
+            self.master.after(STATS_INTERVAL_MS, self.update_stats)
 
     def on_close(self):
         """Handles graceful shutdown."""
         print("Stopping monitor thread...")
         self.running.clear()  # Signal the reading thread to stop
         self.read_thread.join(timeout=1.0) # Wait for the thread to finish
+        self.master.tk.deletefilehandler(self.notify_r)
+        os.close(self.notify_r)
+        os.close(self.notify_w)
         self.master.destroy()
 
 # --- Main Application Execution ---
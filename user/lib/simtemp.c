@@ -0,0 +1,418 @@
+/*
+ * libsimtemp - user space consumer library for /dev/simtemp<N>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "simtemp.h"
+
+#define SYSFS_CLASS_DIR "/sys/class/misc"
+
+struct simtemp {
+	int fd;
+	int event_fd;  /* -1 until simtemp_event_fd() */
+	unsigned int flags;
+	char name[NAME_MAX + 1]; /* simtemp<N>, for the sysfs directory */
+
+	/* mmap() ring, NULL until simtemp_ring_map() */
+	struct simtemp_ring_header *ring_hdr;
+	const struct simtemp_sample *ring_data;
+	size_t ring_bytes;
+	uint64_t ring_mask;
+};
+
+struct simtemp *simtemp_open(const char *path, unsigned int flags)
+{
+	struct simtemp *st;
+	const char *name;
+	int oflags = O_RDWR | O_CLOEXEC;
+
+	if (!path){
+		path = SIMTEMP_DEFAULT_PATH;
+	}
+	if (flags & SIMTEMP_OPEN_NONBLOCK){
+		oflags |= O_NONBLOCK;
+	}
+
+	st = calloc(1, sizeof(*st));
+	if (!st){
+		return NULL;
+	}
+	st->event_fd = -1;
+	st->flags = flags;
+
+	name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	if (strlen(name) >= sizeof(st->name)){
+		free(st);
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	strcpy(st->name, name);
+
+	st->fd = open(path, oflags);
+	if (st->fd < 0){
+		free(st);
+		return NULL;
+	}
+
+	return st;
+}
+
+void simtemp_close(struct simtemp *st)
+{
+	int saved_errno = errno;
+
+	if (!st){
+		return;
+	}
+	if (st->ring_hdr){
+		munmap(st->ring_hdr, st->ring_bytes);
+	}
+	if (st->event_fd >= 0){
+		close(st->event_fd);
+	}
+	close(st->fd);
+	free(st);
+	errno = saved_errno;
+}
+
+int simtemp_fd(const struct simtemp *st)
+{
+	return st->fd;
+}
+
+/* --- Configuration --- */
+
+static int simtemp_ioctl(struct simtemp *st, unsigned long cmd, void *arg)
+{
+	if (ioctl(st->fd, cmd, arg) < 0){
+		return -errno;
+	}
+	return 0;
+}
+
+int simtemp_set_config(struct simtemp *st, uint32_t sampling_us, int32_t threshold_mC)
+{
+	struct simtemp_config_v2 cfg = {
+		.version = SIMTEMP_CONFIG_VERSION,
+		.sampling_us = sampling_us,
+		.threshold_mC = threshold_mC,
+	};
+
+	return simtemp_ioctl(st, SIMTEMP_IOC_SET_CONFIG_V2, &cfg);
+}
+
+int simtemp_set_wakeup(struct simtemp *st, uint32_t watermark, uint32_t timeout_us)
+{
+	struct simtemp_wakeup wakeup = {
+		.watermark = watermark,
+		.timeout_us = timeout_us,
+	};
+
+	return simtemp_ioctl(st, SIMTEMP_IOC_SET_WAKEUP, &wakeup);
+}
+
+int simtemp_get_config(struct simtemp *st, struct simtemp_config_ext *cfg)
+{
+	cfg->size = sizeof(*cfg);
+	return simtemp_ioctl(st, SIMTEMP_IOC_GET_CONFIG_EXT, cfg);
+}
+
+int simtemp_apply_config(struct simtemp *st, struct simtemp_config_ext *cfg)
+{
+	cfg->size = sizeof(*cfg);
+	return simtemp_ioctl(st, SIMTEMP_IOC_SET_CONFIG_EXT, cfg);
+}
+
+int simtemp_get_reader_stats(struct simtemp *st, struct simtemp_reader_stats *stats)
+{
+	return simtemp_ioctl(st, SIMTEMP_IOC_GET_READER_STATS, stats);
+}
+
+int simtemp_get_snapshot(struct simtemp *st, struct simtemp_snapshot *snap)
+{
+	snap->size = sizeof(*snap);
+	return simtemp_ioctl(st, SIMTEMP_IOC_GET_SNAPSHOT, snap);
+}
+
+static int simtemp_attr_open(struct simtemp *st, const char *attr, int oflags)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	if (snprintf(path, sizeof(path), SYSFS_CLASS_DIR "/%s/%s", st->name, attr) >= (int)sizeof(path)){
+		errno = ENAMETOOLONG;
+		return -ENAMETOOLONG;
+	}
+	fd = open(path, oflags | O_CLOEXEC);
+	if (fd < 0){
+		return -errno;
+	}
+	return fd;
+}
+
+int simtemp_attr_read(struct simtemp *st, const char *attr, char *buf, size_t len)
+{
+	ssize_t n;
+	int fd;
+
+	if (!len){
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	fd = simtemp_attr_open(st, attr, O_RDONLY);
+	if (fd < 0){
+		return fd;
+	}
+	n = read(fd, buf, len - 1);
+	if (n < 0){
+		n = -errno;
+		close(fd);
+		return n;
+	}
+	close(fd);
+
+	while (n > 0 && buf[n - 1] == '\n'){
+		n--;
+	}
+	buf[n] = '\0';
+	return 0;
+}
+
+int simtemp_attr_write(struct simtemp *st, const char *attr, const char *value)
+{
+	size_t len = strlen(value);
+	ssize_t n;
+	int fd;
+
+	fd = simtemp_attr_open(st, attr, O_WRONLY);
+	if (fd < 0){
+		return fd;
+	}
+	n = write(fd, value, len);
+	if (n < 0){
+		n = -errno;
+		close(fd);
+		return n;
+	}
+	close(fd);
+	return 0;
+}
+
+/* --- Batched reads --- */
+
+ssize_t simtemp_read(struct simtemp *st, struct simtemp_sample *buf, size_t max)
+{
+	ssize_t n;
+
+	n = read(st->fd, buf, max * sizeof(*buf));
+	if (n < 0){
+		return -errno;
+	}
+	return n / sizeof(*buf);
+}
+
+/* Scatters packed samples into the columns the caller asked for */
+static void simtemp_split(const struct simtemp_sample *src, size_t count, uint64_t *timestamp_ns,
+			  int32_t *temp_mC, uint32_t *flags)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (timestamp_ns){
+			timestamp_ns[i] = src[i].timestamp_ns;
+		}
+		if (temp_mC){
+			temp_mC[i] = src[i].temp_mC;
+		}
+		if (flags){
+			flags[i] = src[i].flags;
+		}
+	}
+}
+
+#define SPLIT_BATCH 1024 /* Samples staged on the stack per read() in the column readers */
+
+ssize_t simtemp_read_columns(struct simtemp *st, uint64_t *timestamp_ns,
+			     int32_t *temp_mC, uint32_t *flags, size_t max)
+{
+	struct simtemp_sample batch[SPLIT_BATCH];
+	ssize_t n;
+
+	/* One read() per call, like simtemp_read(): a short batch means the queue is drained */
+	n = simtemp_read(st, batch, max < SPLIT_BATCH ? max : SPLIT_BATCH);
+	if (n <= 0){
+		return n;
+	}
+	simtemp_split(batch, n, timestamp_ns, temp_mC, flags);
+	return n;
+}
+
+/* --- mmap() ring --- */
+
+int simtemp_ring_map(struct simtemp *st)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	struct simtemp_ring_header *hdr;
+	uint32_t nr_slots, slot_size, data_offset;
+	size_t bytes;
+
+	if (st->ring_hdr){
+		return 0;
+	}
+
+	/* Map the header page alone first to learn the ring geometry */
+	hdr = mmap(NULL, page, PROT_READ, MAP_SHARED, st->fd, 0);
+	if (hdr == MAP_FAILED){
+		return -errno;
+	}
+	if (hdr->version != SIMTEMP_RING_VERSION || hdr->slot_size != sizeof(struct simtemp_sample) ||
+	    !hdr->nr_slots || (hdr->nr_slots & (hdr->nr_slots - 1))) {
+		munmap(hdr, page);
+		errno = EPROTO;
+		return -EPROTO;
+	}
+	nr_slots = hdr->nr_slots;
+	slot_size = hdr->slot_size;
+	data_offset = hdr->data_offset;
+	munmap(hdr, page);
+
+	bytes = data_offset + (size_t)nr_slots * slot_size;
+	hdr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, st->fd, 0);
+	if (hdr == MAP_FAILED){
+		return -errno;
+	}
+
+	st->ring_hdr = hdr;
+	st->ring_data = (const void *)((const char *)hdr + data_offset);
+	st->ring_bytes = bytes;
+	st->ring_mask = nr_slots - 1;
+	return 0;
+}
+
+/*
+ * Returns the first unconsumed index and the number of samples available,
+ * at most @max. The acquire load pairs with the kernel's release of head.
+ */
+static size_t simtemp_ring_avail(struct simtemp *st, uint64_t *tail, size_t max)
+{
+	uint64_t head = __atomic_load_n(&st->ring_hdr->head, __ATOMIC_ACQUIRE);
+	uint64_t avail;
+
+	*tail = st->ring_hdr->tail; /* Only this consumer writes it */
+	avail = head - *tail;
+	return avail < max ? avail : max;
+}
+
+/* Hands slots back to the kernel once they have been copied out */
+static void simtemp_ring_release(struct simtemp *st, uint64_t tail)
+{
+	__atomic_store_n(&st->ring_hdr->tail, tail, __ATOMIC_RELEASE);
+}
+
+ssize_t simtemp_ring_read(struct simtemp *st, struct simtemp_sample *buf, size_t max)
+{
+	uint64_t tail;
+	size_t n, first;
+
+	if (!st->ring_hdr){
+		errno = ENXIO;
+		return -ENXIO;
+	}
+
+	n = simtemp_ring_avail(st, &tail, max);
+	/* At most two copies: up to the end of the ring, then from slot 0 */
+	first = st->ring_mask + 1 - (tail & st->ring_mask);
+	if (first > n){
+		first = n;
+	}
+	memcpy(buf, &st->ring_data[tail & st->ring_mask], first * sizeof(*buf));
+	memcpy(buf + first, st->ring_data, (n - first) * sizeof(*buf));
+
+	simtemp_ring_release(st, tail + n);
+	return n;
+}
+
+ssize_t simtemp_ring_read_columns(struct simtemp *st, uint64_t *timestamp_ns,
+				  int32_t *temp_mC, uint32_t *flags, size_t max)
+{
+	uint64_t tail;
+	size_t n, first;
+
+	if (!st->ring_hdr){
+		errno = ENXIO;
+		return -ENXIO;
+	}
+
+	n = simtemp_ring_avail(st, &tail, max);
+	first = st->ring_mask + 1 - (tail & st->ring_mask);
+	if (first > n){
+		first = n;
+	}
+	simtemp_split(&st->ring_data[tail & st->ring_mask], first, timestamp_ns, temp_mC, flags);
+	simtemp_split(st->ring_data, n - first,
+		      timestamp_ns ? timestamp_ns + first : NULL,
+		      temp_mC ? temp_mC + first : NULL,
+		      flags ? flags + first : NULL);
+
+	simtemp_ring_release(st, tail + n);
+	return n;
+}
+
+uint64_t simtemp_ring_dropped(const struct simtemp *st)
+{
+	if (!st->ring_hdr){
+		return 0;
+	}
+	return __atomic_load_n(&st->ring_hdr->dropped, __ATOMIC_RELAXED);
+}
+
+/* --- Alert events --- */
+
+int simtemp_event_fd(struct simtemp *st)
+{
+	int fd;
+
+	if (st->event_fd >= 0){
+		return st->event_fd;
+	}
+
+	fd = ioctl(st->fd, SIMTEMP_IOC_GET_EVENT_FD);
+	if (fd < 0){
+		return -errno;
+	}
+	/* The driver always creates a blocking fd; follow the handle's mode */
+	if ((st->flags & SIMTEMP_OPEN_NONBLOCK) && fcntl(fd, F_SETFL, O_NONBLOCK) < 0){
+		int ret = -errno;
+
+		close(fd);
+		return ret;
+	}
+
+	st->event_fd = fd;
+	return fd;
+}
+
+ssize_t simtemp_read_events(struct simtemp *st, struct simtemp_event *buf, size_t max)
+{
+	int fd = simtemp_event_fd(st);
+	ssize_t n;
+
+	if (fd < 0){
+		return fd;
+	}
+	n = read(fd, buf, max * sizeof(*buf));
+	if (n < 0){
+		return -errno;
+	}
+	return n / sizeof(*buf);
+}
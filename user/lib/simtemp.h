@@ -0,0 +1,100 @@
+#ifndef SIMTEMP_LIB_H
+#define SIMTEMP_LIB_H
+
+/*
+ * libsimtemp - user space consumer library for /dev/simtemp<N>.
+ *
+ * Wraps the record layouts and ioctls of kernel/nxp_simtemp.h and
+ * kernel/nxp_simtemp_ioctl.h so consumers do not re-implement them. All
+ * functions return 0 (or a count) on success and a negative errno value on
+ * failure; errno is left as set by the failing call.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+
+#include "nxp_simtemp.h"
+#include "nxp_simtemp_ioctl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIMTEMP_DEFAULT_PATH "/dev/simtemp0"
+
+/* Flags for simtemp_open() */
+#define SIMTEMP_OPEN_NONBLOCK (1 << 0) /* Reads return -EAGAIN instead of blocking */
+
+struct simtemp;
+
+/* Opens @path (SIMTEMP_DEFAULT_PATH if NULL); returns NULL and sets errno on failure */
+struct simtemp *simtemp_open(const char *path, unsigned int flags);
+void simtemp_close(struct simtemp *st);
+
+/* The device fd, for poll()/epoll: EPOLLIN when records are queued, EPOLLPRI on alerts */
+int simtemp_fd(const struct simtemp *st);
+
+/* --- Configuration --- */
+
+/* Sets the sampling period and threshold atomically (SIMTEMP_IOC_SET_CONFIG_V2) */
+int simtemp_set_config(struct simtemp *st, uint32_t sampling_us, int32_t threshold_mC);
+int simtemp_set_wakeup(struct simtemp *st, uint32_t watermark, uint32_t timeout_us);
+
+/*
+ * Reads or applies the whole configuration in one ioctl (SIMTEMP_IOC_*_CONFIG_EXT).
+ * @cfg->size is filled in; edit what simtemp_get_config() returned and pass it back.
+ */
+int simtemp_get_config(struct simtemp *st, struct simtemp_config_ext *cfg);
+int simtemp_apply_config(struct simtemp *st, struct simtemp_config_ext *cfg);
+
+int simtemp_get_reader_stats(struct simtemp *st, struct simtemp_reader_stats *stats);
+
+/* Counters, configuration and this handle's backlog in one ioctl (SIMTEMP_IOC_GET_SNAPSHOT) */
+int simtemp_get_snapshot(struct simtemp *st, struct simtemp_snapshot *snap);
+
+/*
+ * Reads or writes /sys/class/misc/simtemp<N>/@attr of this device. The value
+ * is returned without its trailing newline.
+ */
+int simtemp_attr_read(struct simtemp *st, const char *attr, char *buf, size_t len);
+int simtemp_attr_write(struct simtemp *st, const char *attr, const char *value);
+
+/* --- Batched reads --- */
+
+/*
+ * Reads up to @max samples into @buf with a single read(). Returns the
+ * number of samples, 0 at end of stream, or -EAGAIN for a non-blocking
+ * handle with nothing queued.
+ */
+ssize_t simtemp_read(struct simtemp *st, struct simtemp_sample *buf, size_t max);
+
+/* As simtemp_read(), split into caller-owned columns; any column may be NULL */
+ssize_t simtemp_read_columns(struct simtemp *st, uint64_t *timestamp_ns,
+			     int32_t *temp_mC, uint32_t *flags, size_t max);
+
+/* --- mmap() ring --- */
+
+/* Maps the shared sample ring; poll() on simtemp_fd() then reports ring occupancy */
+int simtemp_ring_map(struct simtemp *st);
+
+/* Copies up to @max samples out of the ring and releases their slots; never blocks */
+ssize_t simtemp_ring_read(struct simtemp *st, struct simtemp_sample *buf, size_t max);
+ssize_t simtemp_ring_read_columns(struct simtemp *st, uint64_t *timestamp_ns,
+				  int32_t *temp_mC, uint32_t *flags, size_t max);
+
+/* Samples lost because the ring was full */
+uint64_t simtemp_ring_dropped(const struct simtemp *st);
+
+/* --- Alert events --- */
+
+/* The alert event fd (SIMTEMP_IOC_GET_EVENT_FD), created on first use and owned by @st */
+int simtemp_event_fd(struct simtemp *st);
+ssize_t simtemp_read_events(struct simtemp *st, struct simtemp_event *buf, size_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMTEMP_LIB_H */
@@ -0,0 +1,245 @@
+"""numpy bindings for libsimtemp.
+
+Records come back as numpy arrays filled directly by the C library, so a
+consumer never builds a Python object per sample:
+
+    with simtemp.Device("/dev/simtemp0") as dev:
+        dev.set_config(sampling_us=100, threshold_mC=45000)
+        samples = dev.read(4096)          # structured array, SAMPLE_DTYPE
+        print(samples["temp_mC"].mean())
+
+Device.fileno() is the device fd, so a Device can be registered with
+select/selectors/epoll like a socket. The library is looked up in
+$SIMTEMP_LIB, next to this file, then on the default loader path.
+"""
+
+import ctypes
+import ctypes.util
+import errno
+import os
+
+import numpy as np
+
+# struct simtemp_sample / struct simtemp_event (kernel/nxp_simtemp.h), both packed
+SAMPLE_DTYPE = np.dtype([("timestamp_ns", "<u8"), ("temp_mC", "<i4"), ("flags", "<u4")])
+EVENT_DTYPE = np.dtype([("timestamp_ns", "<u8"), ("seq", "<u8"), ("temp_mC", "<i4"),
+                        ("threshold_mC", "<i4"), ("flags", "<u4"), ("reserved", "<u4")])
+
+OPEN_NONBLOCK = 1 << 0
+
+FLAG_NEW_SAMPLE = 1 << 0
+FLAG_THRESHOLD_CROSSED = 1 << 1
+FLAG_SUMMARY = 1 << 2
+FLAG_THRESHOLD_RISING = 1 << 3
+FLAG_THRESHOLD_FALLING = 1 << 4
+
+
+class ReaderStats(ctypes.Structure):
+    _fields_ = [("cursor", ctypes.c_uint64), ("overruns", ctypes.c_uint64), ("pending", ctypes.c_uint64)]
+
+
+class ConfigExt(ctypes.Structure):
+    """struct simtemp_config_ext (kernel/nxp_simtemp_ioctl.h)."""
+    _fields_ = [("size", ctypes.c_uint32), ("flags", ctypes.c_uint32), ("sampling_us", ctypes.c_uint32),
+                ("threshold_mC", ctypes.c_int32), ("hysteresis_mC", ctypes.c_int32), ("mode", ctypes.c_uint32),
+                ("fifo_depth", ctypes.c_uint32), ("wake_watermark", ctypes.c_uint32),
+                ("wake_timeout_us", ctypes.c_uint32), ("aggregate", ctypes.c_uint32),
+                ("alert_mode", ctypes.c_uint32), ("reserved", ctypes.c_uint32)]
+
+
+class Snapshot(ctypes.Structure):
+    """struct simtemp_snapshot (kernel/nxp_simtemp_ioctl.h)."""
+    _fields_ = [("size", ctypes.c_uint32), ("flags", ctypes.c_uint32), ("timestamp_ns", ctypes.c_uint64)] + \
+               [(name, ctypes.c_int32 if name in ("threshold_mC", "hysteresis_mC", "cpu") else ctypes.c_uint32)
+                for name in ("sampling_us", "threshold_mC", "hysteresis_mC", "mode", "fifo_depth", "wake_watermark",
+                             "wake_timeout_us", "aggregate", "alert_mode", "cpu")] + \
+               [(name, ctypes.c_uint64) for name in ("updates", "alerts", "dropped", "defer_drops", "timer_ticks",
+                                                     "timer_overruns", "hist_head", "fifo_hwm", "pending", "overruns")] + \
+               [("last_error", ctypes.c_int32), ("alert_active", ctypes.c_uint32)]
+
+
+def _load():
+    candidates = [os.environ.get("SIMTEMP_LIB"),
+                  os.path.join(os.path.dirname(os.path.abspath(__file__)), "libsimtemp.so"),
+                  ctypes.util.find_library("simtemp")]
+    for path in candidates:
+        if path and (os.path.exists(path) or not os.path.dirname(path)):
+            return ctypes.CDLL(path, use_errno=True)
+    raise ImportError("libsimtemp.so not found, build it with 'make -C user/lib'")
+
+
+_lib = _load()
+
+_p = ctypes.c_void_p
+_u64p = ctypes.POINTER(ctypes.c_uint64)
+_s32p = ctypes.POINTER(ctypes.c_int32)
+_u32p = ctypes.POINTER(ctypes.c_uint32)
+
+for _name, _res, _args in [
+        ("simtemp_open", _p, [ctypes.c_char_p, ctypes.c_uint]),
+        ("simtemp_close", None, [_p]),
+        ("simtemp_fd", ctypes.c_int, [_p]),
+        ("simtemp_set_config", ctypes.c_int, [_p, ctypes.c_uint32, ctypes.c_int32]),
+        ("simtemp_set_wakeup", ctypes.c_int, [_p, ctypes.c_uint32, ctypes.c_uint32]),
+        ("simtemp_get_config", ctypes.c_int, [_p, ctypes.POINTER(ConfigExt)]),
+        ("simtemp_apply_config", ctypes.c_int, [_p, ctypes.POINTER(ConfigExt)]),
+        ("simtemp_get_snapshot", ctypes.c_int, [_p, ctypes.POINTER(Snapshot)]),
+        ("simtemp_get_reader_stats", ctypes.c_int, [_p, ctypes.POINTER(ReaderStats)]),
+        ("simtemp_attr_read", ctypes.c_int, [_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_size_t]),
+        ("simtemp_attr_write", ctypes.c_int, [_p, ctypes.c_char_p, ctypes.c_char_p]),
+        ("simtemp_read", ctypes.c_ssize_t, [_p, _p, ctypes.c_size_t]),
+        ("simtemp_read_columns", ctypes.c_ssize_t, [_p, _u64p, _s32p, _u32p, ctypes.c_size_t]),
+        ("simtemp_ring_map", ctypes.c_int, [_p]),
+        ("simtemp_ring_read", ctypes.c_ssize_t, [_p, _p, ctypes.c_size_t]),
+        ("simtemp_ring_read_columns", ctypes.c_ssize_t, [_p, _u64p, _s32p, _u32p, ctypes.c_size_t]),
+        ("simtemp_ring_dropped", ctypes.c_uint64, [_p]),
+        ("simtemp_event_fd", ctypes.c_int, [_p]),
+        ("simtemp_read_events", ctypes.c_ssize_t, [_p, _p, ctypes.c_size_t])]:
+    _fn = getattr(_lib, _name)
+    _fn.restype = _res
+    _fn.argtypes = _args
+
+
+def _check(ret):
+    """Raises OSError for a negative errno return, like os.read()."""
+    if ret < 0:
+        raise OSError(-ret, os.strerror(-ret))
+    return ret
+
+
+def _column(arr, dtype, count):
+    """Pointer to a caller-owned C-contiguous column of at least @count entries, or NULL."""
+    if arr is None:
+        return None
+    if arr.dtype != dtype or not arr.flags["C_CONTIGUOUS"] or not arr.flags["WRITEABLE"] or len(arr) < count:
+        raise ValueError(f"column must be a writeable contiguous {np.dtype(dtype)} array of >= {count} entries")
+    return arr.ctypes.data_as(ctypes.POINTER(np.ctypeslib.as_ctypes_type(dtype)))
+
+
+class Device:
+    """One open /dev/simtemp<N>."""
+
+    def __init__(self, path="/dev/simtemp0", nonblock=False):
+        ctypes.set_errno(0)
+        self._h = _lib.simtemp_open(path.encode(), OPEN_NONBLOCK if nonblock else 0)
+        if not self._h:
+            err = ctypes.get_errno()
+            raise OSError(err, os.strerror(err), path)
+
+    def close(self):
+        if self._h:
+            _lib.simtemp_close(self._h)
+            self._h = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def fileno(self):
+        return _lib.simtemp_fd(self._h)
+
+    def event_fileno(self):
+        """The alert event fd, for select/epoll alongside fileno()."""
+        return _check(_lib.simtemp_event_fd(self._h))
+
+    # --- Configuration ---
+
+    def set_config(self, sampling_us, threshold_mC):
+        _check(_lib.simtemp_set_config(self._h, sampling_us, threshold_mC))
+
+    def set_wakeup(self, watermark, timeout_us=0):
+        _check(_lib.simtemp_set_wakeup(self._h, watermark, timeout_us))
+
+    def config(self):
+        """The whole configuration as a dict, see struct simtemp_config_ext."""
+        cfg = ConfigExt()
+        _check(_lib.simtemp_get_config(self._h, ctypes.byref(cfg)))
+        return {name: getattr(cfg, name) for name, _ in ConfigExt._fields_ if name not in ("size", "flags", "reserved")}
+
+    def update_config(self, **changes):
+        """Changes any config fields in one ioctl, e.g. update_config(mode=3, aggregate=10)."""
+        cfg = ConfigExt()
+        _check(_lib.simtemp_get_config(self._h, ctypes.byref(cfg)))
+        for name, value in changes.items():
+            if name in ("size", "flags", "reserved") or not hasattr(cfg, name):
+                raise TypeError(f"unknown config field '{name}'")
+            setattr(cfg, name, value)
+        _check(_lib.simtemp_apply_config(self._h, ctypes.byref(cfg)))
+
+    def reader_stats(self):
+        stats = ReaderStats()
+        _check(_lib.simtemp_get_reader_stats(self._h, ctypes.byref(stats)))
+        return {name: getattr(stats, name) for name, _ in ReaderStats._fields_}
+
+    def snapshot(self):
+        """Counters, configuration and this handle's backlog, read together."""
+        snap = Snapshot()
+        _check(_lib.simtemp_get_snapshot(self._h, ctypes.byref(snap)))
+        return {name: getattr(snap, name) for name, _ in Snapshot._fields_ if name not in ("size", "flags")}
+
+    def attr(self, name):
+        buf = ctypes.create_string_buffer(4096)
+        _check(_lib.simtemp_attr_read(self._h, name.encode(), buf, len(buf)))
+        return buf.value.decode()
+
+    def set_attr(self, name, value):
+        _check(_lib.simtemp_attr_write(self._h, name.encode(), str(value).encode()))
+
+    # --- Reads ---
+    #
+    # Every reader returns an empty result instead of raising when a
+    # non-blocking device has nothing queued.
+
+    def _call(self, fn, *args):
+        ret = fn(self._h, *args)
+        if ret == -errno.EAGAIN:
+            return 0
+        return _check(ret)
+
+    def read_into(self, out):
+        """Fills a caller-owned SAMPLE_DTYPE array with one read(); returns the count."""
+        if out.dtype != SAMPLE_DTYPE or not out.flags["C_CONTIGUOUS"]:
+            raise ValueError("out must be a contiguous SAMPLE_DTYPE array")
+        return self._call(_lib.simtemp_read, out.ctypes.data, len(out))
+
+    def read(self, max_samples=4096):
+        """Returns up to @max_samples samples as a SAMPLE_DTYPE array."""
+        out = np.empty(max_samples, SAMPLE_DTYPE)
+        return out[:self.read_into(out)]
+
+    def read_columns_into(self, timestamp_ns=None, temp_mC=None, flags=None, count=None):
+        """Fills caller-owned uint64/int32/uint32 columns; any may be None."""
+        count = count if count is not None else min(len(c) for c in (timestamp_ns, temp_mC, flags) if c is not None)
+        return self._call(_lib.simtemp_read_columns, _column(timestamp_ns, np.uint64, count),
+                          _column(temp_mC, np.int32, count), _column(flags, np.uint32, count), count)
+
+    # --- mmap() ring ---
+
+    def map_ring(self):
+        _check(_lib.simtemp_ring_map(self._h))
+
+    def ring_read_into(self, out):
+        if out.dtype != SAMPLE_DTYPE or not out.flags["C_CONTIGUOUS"]:
+            raise ValueError("out must be a contiguous SAMPLE_DTYPE array")
+        return self._call(_lib.simtemp_ring_read, out.ctypes.data, len(out))
+
+    def ring_read(self, max_samples=1024):
+        """Drains up to @max_samples samples from the mapped ring; never blocks."""
+        out = np.empty(max_samples, SAMPLE_DTYPE)
+        return out[:self.ring_read_into(out)]
+
+    def ring_read_columns_into(self, timestamp_ns=None, temp_mC=None, flags=None, count=None):
+        count = count if count is not None else min(len(c) for c in (timestamp_ns, temp_mC, flags) if c is not None)
+        return self._call(_lib.simtemp_ring_read_columns, _column(timestamp_ns, np.uint64, count),
+                          _column(temp_mC, np.int32, count), _column(flags, np.uint32, count), count)
+
+    def ring_dropped(self):
+        return _lib.simtemp_ring_dropped(self._h)
+
+    # --- Alert events ---
+
+    def read_events(self, max_events=64):
+        out = np.empty(max_events, EVENT_DTYPE)
+        return out[:self._call(_lib.simtemp_read_events, out.ctypes.data, max_events)]